@@ -0,0 +1,327 @@
+#ifndef AUTOMATON_FILE_H
+#define AUTOMATON_FILE_H
+
+#include "mapped_file.h"
+#include "regex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Compiled rules stored on disk, so that processes map them instead of
+ * compiling every pattern at start. Files are written by regexc and opened
+ * with AutomatonFile::open, which only checks the header: the DFAs of a rule
+ * are used in place through DfaView. The first load of a DFA checks every
+ * entry of its tables, so a corrupt file throws instead of sending DfaView
+ * outside the mapping, and that check faults in all of the DFA's pages.
+ * Later loads of the same DFA skip the check and only build the view.
+ *
+ * Layout, integers in host byte order and every section aligned to 8 bytes:
+ *
+ *   AutomatonFileHeader              magic, version, rule count, file size
+ *   AutomatonRuleEntry[ruleCount]    where the parts of each rule are
+ *   for every rule
+ *     the pattern
+ *     the full match DFA and the search DFA, each as
+ *       AutomatonDfaHeader           state and class counts
+ *       unsigned char classes[256]   byte to class
+ *       int32_t transitions[]        states * classes, row major
+ *       int32_t acceptIds[states]    the rule number, -1 if not accepting
+ *
+ * A DFA offset of 0 marks an automaton that grew past Regex::maxDfaStates,
+ * those rules still have to be compiled by whoever loads the file. Files of
+ * other versions are rejected, never converted.
+ */
+
+struct AutomatonFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t ruleCount;
+  uint64_t fileSize;
+};
+
+struct AutomatonRuleEntry {
+  uint64_t patternOffset;
+  uint64_t patternSize;
+  uint64_t fullMatchOffset;
+  uint64_t searchOffset;
+};
+
+struct AutomatonDfaHeader {
+  uint32_t stateCount;
+  uint32_t classCount;
+};
+
+// a Dfa whose tables live somewhere else, usually in a mapped file
+class DfaView {
+private:
+  const unsigned char *classes = nullptr;
+  const int32_t *transitions = nullptr;
+  const int32_t *acceptIds = nullptr;
+  int stride = 0;
+  int stateCount = 0;
+
+public:
+  DfaView() {}
+
+  DfaView(const unsigned char *classes, const int32_t *transitions,
+          const int32_t *acceptIds, int stride, int stateCount)
+      : classes(classes), transitions(transitions), acceptIds(acceptIds),
+        stride(stride), stateCount(stateCount) {}
+
+  int getStateCount() const { return this->stateCount; }
+
+  int getClassCount() const { return this->stride; }
+
+  // the id stored for the state input ends in, -1 when it does not match
+  int getAcceptId(std::string_view input) const {
+    const unsigned char *classes = this->classes;
+    const int32_t *table = this->transitions;
+    int stride = this->stride;
+    int state = Dfa::startState;
+    for (unsigned char c : input) {
+      state = table[state * stride + classes[c]];
+    }
+    return this->acceptIds[state];
+  }
+
+  bool runSimulation(std::string_view input) const {
+    return this->getAcceptId(input) >= 0;
+  }
+};
+
+class AutomatonFile {
+private:
+  static constexpr char magic[8] = {'R', 'G', 'X', 'A', 'U', 'T', 'O', '\0'};
+  static constexpr uint32_t version = 1;
+
+  std::unique_ptr<MappedFile> file;
+  std::string_view contents;
+  uint32_t ruleCount = 0;
+  // per rule, whether its full match and search DFAs passed checkTables
+  std::unique_ptr<std::atomic<bool>[]> checked;
+
+  static void align(std::string &out) {
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+  }
+
+  static void append(std::string &out, const void *data, size_t size) {
+    out.append(static_cast<const char *>(data), size);
+  }
+
+  static uint64_t appendDfa(std::string &out, const Dfa *dfa,
+                            int32_t acceptId) {
+    if (dfa == nullptr) {
+      return 0;
+    }
+    align(out);
+    uint64_t offset = out.size();
+
+    AutomatonDfaHeader header;
+    header.stateCount = dfa->getStateCount();
+    header.classCount = dfa->getClassCount();
+    append(out, &header, sizeof(header));
+
+    for (int c = 0; c < 256; c++) {
+      out.push_back(dfa->getByteClasses().get(c));
+    }
+    for (int state = 0; state < dfa->getStateCount(); state++) {
+      for (int byteClass = 0; byteClass < dfa->getClassCount(); byteClass++) {
+        int32_t target = dfa->getClassTransition(state, byteClass);
+        append(out, &target, sizeof(target));
+      }
+    }
+    for (int state = 0; state < dfa->getStateCount(); state++) {
+      int32_t id = dfa->isAccepting(state) ? acceptId : -1;
+      append(out, &id, sizeof(id));
+    }
+    return offset;
+  }
+
+  void checkRange(uint64_t offset, uint64_t size) const {
+    if (offset > this->contents.size() ||
+        size > this->contents.size() - offset) {
+      throw std::runtime_error("Corrupt automaton file");
+    }
+  }
+
+  AutomatonRuleEntry getEntry(size_t rule) const {
+    if (rule >= this->ruleCount) {
+      throw std::out_of_range("No such rule");
+    }
+    AutomatonRuleEntry entry;
+    std::memcpy(&entry,
+                this->contents.data() + sizeof(AutomatonFileHeader) +
+                    rule * sizeof(AutomatonRuleEntry),
+                sizeof(entry));
+    return entry;
+  }
+
+  // every byte class, transition target and accept id has to be in range,
+  // DfaView follows them without checking
+  static void checkTables(const unsigned char *classes,
+                          const int32_t *transitions, const int32_t *acceptIds,
+                          const AutomatonDfaHeader &header, size_t rule) {
+    for (int c = 0; c < 256; c++) {
+      if (classes[c] >= header.classCount) {
+        throw std::runtime_error("Corrupt automaton file");
+      }
+    }
+    uint64_t cells = uint64_t(header.stateCount) * header.classCount;
+    for (uint64_t cell = 0; cell < cells; cell++) {
+      int32_t target;
+      std::memcpy(&target, transitions + cell, sizeof(target));
+      if (target < 0 || uint32_t(target) >= header.stateCount) {
+        throw std::runtime_error("Corrupt automaton file");
+      }
+    }
+    for (uint32_t state = 0; state < header.stateCount; state++) {
+      int32_t id;
+      std::memcpy(&id, acceptIds + state, sizeof(id));
+      if (id != -1 && uint64_t(id) != rule) {
+        throw std::runtime_error("Corrupt automaton file");
+      }
+    }
+  }
+
+  bool getDfa(uint64_t offset, size_t rule, bool search,
+              DfaView &view) const {
+    if (offset == 0) {
+      return false;
+    }
+    if (offset % 8 != 0) {
+      throw std::runtime_error("Corrupt automaton file");
+    }
+    this->checkRange(offset, sizeof(AutomatonDfaHeader));
+    AutomatonDfaHeader header;
+    std::memcpy(&header, this->contents.data() + offset, sizeof(header));
+
+    uint64_t cells = uint64_t(header.stateCount) * header.classCount;
+    uint64_t tables = sizeof(AutomatonDfaHeader) + 256 +
+                      sizeof(int32_t) * (cells + header.stateCount);
+    this->checkRange(offset, tables);
+    if (header.stateCount <= Dfa::startState || header.classCount == 0) {
+      throw std::runtime_error("Corrupt automaton file");
+    }
+
+    const char *base = this->contents.data() + offset;
+    const unsigned char *classes = reinterpret_cast<const unsigned char *>(
+        base + sizeof(AutomatonDfaHeader));
+    const int32_t *transitions =
+        reinterpret_cast<const int32_t *>(classes + 256);
+    // threads loading the same DFA at once may both check it, which only
+    // repeats the work
+    std::atomic<bool> &checked = this->checked[rule * 2 + search];
+    if (!checked.load(std::memory_order_acquire)) {
+      checkTables(classes, transitions, transitions + cells, header, rule);
+      checked.store(true, std::memory_order_release);
+    }
+    view = DfaView(classes, transitions, transitions + cells,
+                   header.classCount, header.stateCount);
+    return true;
+  }
+
+public:
+  AutomatonFile() {}
+
+  // the file contents for rules, rule i accepts with id i
+  static std::string serialize(const std::vector<const Regex *> &rules) {
+    std::string out;
+    AutomatonFileHeader header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.ruleCount = rules.size();
+    header.fileSize = 0;
+    append(out, &header, sizeof(header));
+
+    size_t entriesOffset = out.size();
+    out.resize(out.size() + rules.size() * sizeof(AutomatonRuleEntry), '\0');
+
+    for (size_t rule = 0; rule < rules.size(); rule++) {
+      AutomatonRuleEntry entry;
+      align(out);
+      entry.patternOffset = out.size();
+      entry.patternSize = rules[rule]->getPattern().size();
+      out += rules[rule]->getPattern();
+      entry.fullMatchOffset = appendDfa(out, rules[rule]->getDfa(), rule);
+      entry.searchOffset =
+          appendDfa(out, rules[rule]->getUnanchoredDfa(), rule);
+      std::memcpy(out.data() + entriesOffset + rule * sizeof(entry), &entry,
+                  sizeof(entry));
+    }
+
+    align(out);
+    header.fileSize = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+    return out;
+  }
+
+  static bool write(const std::string &path,
+                    const std::vector<const Regex *> &rules) {
+    std::string contents = serialize(rules);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size());
+    return static_cast<bool>(out);
+  }
+
+  // nullptr when the file can not be read or is not a complete automaton
+  // file of this version
+  static std::unique_ptr<AutomatonFile> open(const std::string &path) {
+    std::unique_ptr<MappedFile> file = MappedFile::open(path, MADV_RANDOM);
+    if (file == nullptr) {
+      return nullptr;
+    }
+    std::string_view contents = file->contents();
+    if (contents.size() < sizeof(AutomatonFileHeader)) {
+      return nullptr;
+    }
+
+    AutomatonFileHeader header;
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.version != version || header.fileSize != contents.size() ||
+        (contents.size() - sizeof(header)) / sizeof(AutomatonRuleEntry) <
+            header.ruleCount) {
+      return nullptr;
+    }
+
+    std::unique_ptr<AutomatonFile> automata =
+        std::make_unique<AutomatonFile>();
+    automata->file = std::move(file);
+    automata->contents = contents;
+    automata->ruleCount = header.ruleCount;
+    automata->checked =
+        std::make_unique<std::atomic<bool>[]>(size_t(header.ruleCount) * 2);
+    return automata;
+  }
+
+  size_t size() const { return this->ruleCount; }
+
+  std::string_view getPattern(size_t rule) const {
+    AutomatonRuleEntry entry = this->getEntry(rule);
+    this->checkRange(entry.patternOffset, entry.patternSize);
+    return this->contents.substr(entry.patternOffset, entry.patternSize);
+  }
+
+  // the DFA for full matches of rule, false when it was not stored. Only the
+  // first call walks the tables, later ones cost a few header reads
+  bool getFullMatchDfa(size_t rule, DfaView &view) const {
+    return this->getDfa(this->getEntry(rule).fullMatchOffset, rule, false,
+                        view);
+  }
+
+  // the DFA telling whether an input contains a match of rule, false when it
+  // was not stored
+  bool getSearchDfa(size_t rule, DfaView &view) const {
+    return this->getDfa(this->getEntry(rule).searchOffset, rule, true, view);
+  }
+};
+
+#endif
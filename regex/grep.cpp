@@ -0,0 +1,118 @@
+#include "mapped_file.h"
+#include "regex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+ * grep for the regex engine: prints every line of the given files that
+ * contains a match of the pattern, prefixed with its line number (and the
+ * file name when there are several files).
+ *
+ * Files are mmapped instead of read so the kernel pages them in behind the
+ * scan. When the pattern has a required literal the scan jumps from one
+ * occurrence of that literal to the next with the vectorized literal search
+ * and only the lines holding one are handed to the automaton, lines in
+ * between are only counted.
+ */
+
+// returns the number of matching lines
+size_t grepFile(const Regex &regex, std::string_view contents,
+                const std::string &label) {
+  const std::string &required = regex.getPrefilter().getRequired();
+  const char *begin = contents.data();
+  const char *end = begin + contents.size();
+
+  const char *lineStart = begin;
+  size_t lineNumber = 1;
+  size_t matches = 0;
+
+  while (lineStart < end) {
+    if (!required.empty()) {
+      // only lines holding the required literal can match
+      const char *candidate = findLiteral(lineStart, end - lineStart, required);
+      if (candidate == nullptr) {
+        break;
+      }
+      const char *skipTo = candidate;
+      while (skipTo > lineStart && skipTo[-1] != '\n') {
+        skipTo--;
+      }
+      lineNumber += std::count(lineStart, skipTo, '\n');
+      lineStart = skipTo;
+    }
+
+    const char *lineEnd = static_cast<const char *>(
+        std::memchr(lineStart, '\n', end - lineStart));
+    if (lineEnd == nullptr) {
+      lineEnd = end;
+    }
+
+    std::string_view line(lineStart, lineEnd - lineStart);
+    if (regex.contains(line)) {
+      matches++;
+      if (!label.empty()) {
+        std::fwrite(label.data(), 1, label.size(), stdout);
+        std::fputc(':', stdout);
+      }
+      std::fprintf(stdout, "%zu:", lineNumber);
+      std::fwrite(line.data(), 1, line.size(), stdout);
+      std::fputc('\n', stdout);
+    }
+
+    lineStart = lineEnd + 1;
+    lineNumber++;
+  }
+
+  return matches;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " PATTERN FILE..." << std::endl;
+    return 2;
+  }
+
+  std::unique_ptr<Regex> regex;
+  try {
+    regex = Regex::compile(argv[1]);
+  } catch (const std::exception &error) {
+    std::cerr << "invalid pattern " << argv[1] << ": " << error.what()
+              << std::endl;
+    return 2;
+  }
+
+  static char outputBuffer[1 << 16];
+  std::setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+  bool anyMatch = false;
+  bool failed = false;
+  for (int i = 2; i < argc; i++) {
+    std::unique_ptr<MappedFile> file = MappedFile::open(argv[i]);
+    if (file == nullptr) {
+      std::cerr << argv[0] << ": " << argv[i] << ": " << std::strerror(errno)
+                << std::endl;
+      failed = true;
+      continue;
+    }
+
+    std::string label = argc > 3 ? argv[i] : "";
+    if (grepFile(*regex, file->contents(), label) > 0) {
+      anyMatch = true;
+    }
+  }
+
+  std::fflush(stdout);
+
+  // same exit codes as grep
+  if (failed) {
+    return 2;
+  }
+  return anyMatch ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A read only file mapped into memory, the kernel pages it in as it is
+ * touched. advice is passed on to madvise: sequential scans read ahead,
+ * random lookups into tables do not.
+ */
+class MappedFile {
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+
+public:
+  MappedFile() {}
+
+  ~MappedFile() {
+    if (this->data != nullptr) {
+      munmap(const_cast<char *>(this->data), this->size);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  static std::unique_ptr<MappedFile> open(const std::string &path,
+                                          int advice = MADV_SEQUENTIAL) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+      close(fd);
+      return nullptr;
+    }
+
+    std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+    file->size = info.st_size;
+    if (file->size > 0) {
+      void *mapped = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+      }
+      madvise(mapped, file->size, advice);
+      file->data = static_cast<const char *>(mapped);
+    }
+    close(fd);
+
+    return file;
+  }
+
+  std::string_view contents() const {
+    return std::string_view(this->data, this->size);
+  }
+};
+
+#endif
@@ -1,604 +1,1146 @@
-#include <algorithm>
+#include "automaton_file.h"
+#include "regex.h"
+#include "static_regex.h"
+
 #include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <stdexcept>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
 #include <utility>
 #include <vector>
 
-/*
- * Primitives:
- * - For now if something is not an operator we treat it as a literal
- *
- * Concatenation:
- * - "+"
- *
- * Alternation:
- * - "|"
- *
- * Kleene Star:
- * - "*"
- *
- * Grouping & Paranthesis:
- * - "( )"
- * */
-
-/*
- * Epsilon NFA Explanation Copy Pasta:
- *
- *An ε-NFA (epsilon-Nondeterministic Finite Automaton) is a type of finite
-automaton used in theoretical computer science and formal language theory to
-describe and recognize regular languages. It is an extension of a traditional
-NFA (Nondeterministic Finite Automaton) with the addition of epsilon transitions
-(also known as ε-transitions or lambda transitions).
-
-Let's break down the components and concepts of an ε-NFA in absolute detail:
-
-States: An ε-NFA consists of a finite set of states, often denoted by Q. Each
-state represents a specific condition or configuration of the automaton.
-
-Alphabet: There is a finite input alphabet Σ, which consists of symbols or
-characters that the automaton reads from an input string. These symbols are the
-basic building blocks of the language.
-
-Transitions: Unlike a traditional DFA (Deterministic Finite Automaton), an ε-NFA
-can have multiple transitions for a given state and input symbol. These
-transitions are non-deterministic, meaning that the automaton can move to
-multiple states at once when processing a particular symbol. Additionally,
-ε-NFAs can have epsilon transitions (ε-transitions), which are transitions that
-occur without consuming any input symbol. An ε-transition allows the automaton
-to move from one state to another without reading any input, effectively adding
-an extra dimension to its computation.
-
-Start State: There is a designated start state (often denoted as q0) where the
-automaton begins its computation.
-
-Accept States: The ε-NFA also has a set of accept states (or final states),
-which are states that, when reached after processing the entire input string,
-indicate that the automaton recognizes the input string as a valid member of the
-language.
-
-Epsilon Transitions: Epsilon transitions (ε-transitions) are transitions that
-are not associated with any input symbol. They are represented using the ε
-symbol. When the automaton encounters an ε-transition, it can move from the
-current state to the target state without consuming any input symbol. Epsilon
-transitions allow for non-determinism, as the automaton can make choices without
-needing any input cues.
-
-Language Recognition: To determine whether a given input string belongs to the
-language recognized by the ε-NFA, the automaton explores all possible paths
-through its states, considering both regular transitions (based on input
-symbols) and ε-transitions. It accepts the input string if there exists at least
-one path that leads to an accept state after processing the entire input.
-
-Equivalence to Regular Languages: ε-NFAs are capable of recognizing the same
-class of languages as DFAs and NFAs. This means that any language recognized by
-an ε-NFA can also be recognized by a regular NFA or DFA. Similarly, any language
-recognized by a regular NFA or DFA can be recognized by an ε-NFA.
- * */
-
-char groupingAndRelations[5] = {'*', '|', '+', '(', ')'};
-
-bool isOperatorOrGroups(char a) {
-  for (int i = 0; i < 5; i++) {
-    if (groupingAndRelations[i] == a) {
-      return true;
+// calls check with every string over alphabet up to maxLength bytes, the
+// shorter ones first
+template <typename Check>
+void forEachInput(const std::string &alphabet, size_t maxLength,
+                  Check check) {
+  std::vector<std::string> inputs = {""};
+  for (size_t i = 0; i < inputs.size(); i++) {
+    check(inputs[i]);
+    if (inputs[i].size() < maxLength) {
+      for (char c : alphabet) {
+        inputs.push_back(inputs[i] + c);
+      }
     }
   }
-  return false;
 }
 
-bool isOperatorOrGroups(const std::string &x) {
-  if (x.size() != 1) {
-    return false;
+// what build returns, without the trace of everything it compiles
+template <typename Build> auto untraced(Build build) {
+  traceCompilation = false;
+  auto built = build();
+  traceCompilation = true;
+  return built;
+}
+
+template <typename Matcher>
+void evaluate(const std::string &engine, const std::string &regex,
+              Matcher &matcher, const std::vector<std::string> &matches,
+              const std::vector<std::string> &notMatches) {
+  std::cout << "######## Evaluate against " << engine << " #########"
+            << std::endl;
+
+  for (const std::string &trues : matches) {
+    bool mustBeTrue = matcher.runSimulation(trues);
+    if (!mustBeTrue) {
+      std::cout << "Test case " << trues << " FAILED against " << engine
+                << " for Regex " << regex << std::endl;
+      assert(false);
+    }
+  }
+
+  for (const std::string &falses : notMatches) {
+    bool mustBeFalse = matcher.runSimulation(falses);
+    if (mustBeFalse) {
+      std::cout << "Test case " << falses << " FAILED against " << engine
+                << " for Regex " << regex << std::endl;
+      assert(false);
+    }
   }
-  return isOperatorOrGroups(x[0]);
 }
 
-class Nfa {
-private:
-  std::unordered_set<int> finalStates;
-  std::unordered_map<int, std::unordered_set<int>> epsilonTransitions;
-  std::unordered_map<int,
-                     std::unordered_map<std::string, std::unordered_set<int>>>
-      transitions;
+void test(const std::string &regex, std::vector<std::string> matches,
+          std::vector<std::string> notMatches) {
+  std::cout << "INFIX Regex: " << regex << std::endl;
 
-  int stateCounter = 0;
+  std::cout << "######## COMPILE TO NFA ########" << std::endl;
 
-public:
-  const int startState =
-      0; // Based on how states are create 0 is always the init state
-  const int endAcceptanceState =
-      1; // Based on how states are created 1 is always the accepting state
+  RegexAst ast = RegexAst::parse(regex);
+  std::unique_ptr<Nfa> nfa = buildNfa(ast);
 
-  static std::unique_ptr<Nfa> createEpsilonNfa() {
-    std::unique_ptr<Nfa> base = std::make_unique<Nfa>();
-    base->addEpsilonTransition(base->createNewState(), base->createNewState());
+  std::cout << "######## Completed Nfa: for " << regex << " #########"
+            << std::endl;
 
-    base->addFinalState(base->endAcceptanceState);
+  nfa->print();
 
-    return base;
-  }
+  evaluate("NFA", regex, *nfa, matches, notMatches);
+
+  std::cout << "######## Compile NFA to DFA #########" << std::endl;
+
+  std::unique_ptr<Dfa> dfa = Dfa::fromNfa(*nfa);
+
+  dfa->print();
 
-  Nfa() {}
+  evaluate("DFA", regex, *dfa, matches, notMatches);
 
-  int createNewState() {
-    this->stateCounter++;
-    return this->stateCounter - 1;
+  std::unique_ptr<Dfa> minimalDfa = Dfa::minimize(*dfa);
+
+  std::cout << "Minimized DFA from " << dfa->getStateCount() << " to "
+            << minimalDfa->getStateCount() << " states" << std::endl;
+
+  evaluate("Minimal DFA", regex, *minimalDfa, matches, notMatches);
+
+  std::unique_ptr<JitDfa> jitDfa = JitDfa::compile(*minimalDfa);
+  if (jitDfa != nullptr) {
+    std::cout << "JIT compiled the minimal DFA into " << jitDfa->getCodeSize()
+              << " bytes" << std::endl;
+    evaluate("JIT DFA", regex, *jitDfa, matches, notMatches);
   }
 
-  void addTransition(int fromState, const std::string &symbol, int toState) {
-    this->transitions[fromState][symbol].insert(toState);
+  std::unique_ptr<GlushkovNfa> glushkov = GlushkovNfa::fromAst(ast);
+  if (glushkov != nullptr) {
+    std::cout << "Glushkov automaton with " << glushkov->getPositionCount()
+              << " positions" << std::endl;
+    evaluate("Glushkov", regex, *glushkov, matches, notMatches);
   }
 
-  void addEpsilonTransition(int fromState, int toState) {
-    this->epsilonTransitions[fromState].insert(toState);
+  Prefilter prefilter = Prefilter::fromAst(ast);
+  prefilter.print();
+  PrefilteredMatcher<Dfa> prefilteredDfa(prefilter, *minimalDfa);
+  evaluate("Prefiltered DFA", regex, prefilteredDfa, matches, notMatches);
+
+  LazyDfa lazyDfa(*nfa, 1 << 20);
+  evaluate("Lazy DFA", regex, lazyDfa, matches, notMatches);
+
+  // a budget of a handful of states forces flushes and NFA fallbacks
+  LazyDfa tinyLazyDfa(
+      *nfa, 4 * LazyDfa::stateCost(nfa->getByteClasses().size(), 4));
+  evaluate("Lazy DFA with a tiny cache", regex, tinyLazyDfa, matches,
+           notMatches);
+  std::cout << "Tiny cache flushes: " << tinyLazyDfa.getFlushCount()
+            << ", NFA fallbacks: " << tinyLazyDfa.getFallbackCount()
+            << std::endl;
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// regex has to parse into the tree printed as expected
+void testParse(const std::string &regex, const std::string &expected) {
+  std::cout << "######## Parse " << regex << " #########" << std::endl;
+
+  std::string tree = RegexAst::parse(regex).toString();
+  if (tree != expected) {
+    std::cout << "Parsed " << regex << " into " << tree << ", expected "
+              << expected << std::endl;
+    assert(false);
   }
 
-  bool hasEpsilonTransitions(int state) {
-    std::unordered_map<int, std::unordered_set<int>>::iterator found =
-        this->epsilonTransitions.find(state);
-    if (found == this->epsilonTransitions.end()) {
-      return false;
-    }
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-    return !this->epsilonTransitions[state].empty();
+// regex has to simplify into the tree printed as expected, and the NFAs of
+// both trees have to report the same spans for every input over alphabet up
+// to maxLength bytes
+void testSimplify(const std::string &regex, bool keepGroups,
+                  const std::string &expected, const std::string &alphabet,
+                  size_t maxLength) {
+  std::cout << "######## Simplify " << regex << " #########" << std::endl;
+
+  RegexAst ast = RegexAst::parse(regex);
+  RegexAst simplified = ast.simplify(keepGroups);
+  std::string tree = simplified.toString();
+  if (tree != expected) {
+    std::cout << "Simplified " << regex << " into " << tree << ", expected "
+              << expected << std::endl;
+    assert(false);
   }
 
-  void transferEpsilonTransitions(int owner, int transferTo) {
-    std::unordered_map<int, std::unordered_set<int>>::iterator found =
-        this->epsilonTransitions.find(owner);
-    if (found == this->epsilonTransitions.end()) {
-      std::cout << "nothing transfered" << std::endl;
-      return;
+  std::unique_ptr<Nfa> nfa = untraced([&] { return buildNfa(ast); });
+  std::unique_ptr<Nfa> smaller = untraced([&] { return buildNfa(simplified); });
+  std::cout << nfa->getStateCount() << " states before, "
+            << smaller->getStateCount() << " after" << std::endl;
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    for (MatchKind kind : {MatchKind::LeftmostFirst,
+                           MatchKind::LeftmostLongest}) {
+      Match expectedMatch;
+      Match match;
+      bool matched = nfa->search(input, 0, kind, expectedMatch);
+      if (smaller->search(input, 0, kind, match) != matched ||
+          (matched && !(match == expectedMatch))) {
+        std::cout << "Simplified pattern disagrees on " << input << std::endl;
+        assert(false);
+      }
     }
-    std::unordered_set<int> epsilons = this->epsilonTransitions[owner];
-    this->epsilonTransitions[transferTo] = epsilons;
-    this->epsilonTransitions[owner] = std::unordered_set<int>();
+  });
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// true when the static parser rejects regex, which fails the build when it
+// runs during compilation
+bool staticRejects(const std::string &regex) {
+  try {
+    staticNfa(regex);
+  } catch (const std::invalid_argument &) {
+    return true;
   }
+  return false;
+}
 
-  void removeEpsilonTransition(int fromState, int toState) {
-    std::unordered_map<int, std::unordered_set<int>>::iterator found =
-        this->epsilonTransitions.find(fromState);
-    if (found == this->epsilonTransitions.end()) {
-      return;
-    }
+// both parsers have to reject regex
+void testParseError(const std::string &regex) {
+  std::cout << "######## Reject " << regex << " #########" << std::endl;
 
-    this->epsilonTransitions[fromState].erase(toState);
+  bool threw = false;
+  try {
+    RegexAst::parse(regex);
+  } catch (const std::invalid_argument &error) {
+    std::cout << error.what() << std::endl;
+    threw = true;
   }
+  assert(threw);
+  assert(staticRejects(regex));
 
-  void addFinalState(int state) { finalStates.insert(state); }
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-  /*
-   * Given an input string iterate over each character
-   * for each character we are going to explore a next path
-   * if there are any explorations that result in an accepted state
-   * we return true, otherwise false.
-   */
-  bool runSimulation(const std::string &input) {
-    int hardLimitSelfLoop = 100;
-    std::unordered_map<int, int> selfLoopTransitions;
+// the minimal DFA for regex must have exactly expectedStates states, counting
+// the dead state
+void testMinimization(const std::string &regex, int expectedStates) {
+  std::cout << "######## Minimize DFA for " << regex << " #########"
+            << std::endl;
 
-    int transitionEndsAt = input.size();
+  std::unique_ptr<Nfa> nfa = buildNfa(RegexAst::parse(regex));
+  std::unique_ptr<Dfa> minimalDfa = Dfa::minimize(*Dfa::fromNfa(*nfa));
 
-    // stack stores the current state and the current character index being
-    // explored
-    std::vector<std::pair<int, int>> stack;
-    // add the intial state onto the stack
-    std::pair<int, int> initial = std::make_pair(this->startState, 0);
-    stack.push_back(initial);
+  if (minimalDfa->getStateCount() != expectedStates) {
+    std::cout << "Minimal DFA for " << regex << " has "
+              << minimalDfa->getStateCount() << " states, expected "
+              << expectedStates << std::endl;
+    assert(false);
+  }
 
-    while (!stack.empty()) {
-      std::pair<int, int> candidate = stack[stack.size() - 1];
-      stack.pop_back();
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      if (candidate.second == transitionEndsAt &&
-          candidate.first == this->endAcceptanceState) {
-        return true;
-      }
+// the compiled DFA for regex must need exactly expectedClasses columns
+void testByteClasses(const std::string &regex, int expectedClasses) {
+  std::cout << "######## Byte classes for " << regex << " #########"
+            << std::endl;
 
-      // epsilon transitions
-      std::unordered_map<int, std::unordered_set<int>>::iterator found =
-          this->epsilonTransitions.find(candidate.first);
-      if (found != this->epsilonTransitions.end()) {
-        std::unordered_set<int> epsilonTransitions =
-            this->epsilonTransitions[candidate.first];
-        for (int nextState : epsilonTransitions) {
-          std::pair<int, int> toExplore =
-              std::make_pair(nextState, candidate.second);
-          // Check if already looped before and if at max limit
-          std::unordered_map<int, int>::iterator loopedBefore =
-              selfLoopTransitions.find(nextState);
-          if (loopedBefore != selfLoopTransitions.end() &&
-              selfLoopTransitions[nextState] > hardLimitSelfLoop) {
-            continue;
-          }
-
-          if (loopedBefore != selfLoopTransitions.end()) {
-            selfLoopTransitions[nextState] += 1;
-          } else {
-            selfLoopTransitions[nextState] = 1;
-          }
-
-          stack.push_back(toExplore);
-        }
-      }
+  std::unique_ptr<Nfa> nfa = buildNfa(RegexAst::parse(regex));
+  std::unique_ptr<Dfa> dfa = Dfa::fromNfa(*nfa);
 
-      // when we are on last index of input string only epsilon transitions are
-      // allowed
-      if (candidate.second == transitionEndsAt) {
-        continue;
-      }
+  if (dfa->getClassCount() != expectedClasses) {
+    std::cout << "DFA for " << regex << " has " << dfa->getClassCount()
+              << " byte classes, expected " << expectedClasses << std::endl;
+    assert(false);
+  }
 
-      // action based transitions
-      std::unordered_map<
-          int,
-          std::unordered_map<std::string, std::unordered_set<int>>>::iterator
-          foundTransitionAbleState = this->transitions.find(candidate.first);
-      if (foundTransitionAbleState != this->transitions.end()) {
-        std::unordered_map<std::string, std::unordered_set<int>>
-            actionTransitions = this->transitions[candidate.first];
-
-        std::string symbol = std::string(1, input.at(candidate.second));
-
-        std::unordered_map<std::string, std::unordered_set<int>>::iterator
-            foundSymbol = actionTransitions.find(symbol);
-
-        if (foundSymbol != actionTransitions.end()) {
-          std::unordered_set<int> nextStates = actionTransitions[symbol];
-          int nextIdx = candidate.second + 1;
-          for (int nextState : nextStates) {
-            std::pair<int, int> exploration =
-                std::make_pair(nextState, nextIdx);
-            stack.push_back(exploration);
-          }
-        }
-      }
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// every input must match exactly the patterns listed for it
+void testRegexSet(
+    const std::vector<std::string> &patterns,
+    const std::vector<std::pair<std::string, std::vector<int>>> &cases) {
+  std::cout << "######## Regex set of " << patterns.size()
+            << " patterns #########" << std::endl;
+
+  std::unique_ptr<RegexSet> set = RegexSet::compile(patterns);
+
+  for (const std::pair<std::string, std::vector<int>> &testCase : cases) {
+    std::vector<int> matched = set->matches(testCase.first);
+    if (matched != testCase.second) {
+      std::cout << "Test case " << testCase.first << " matched "
+                << matched.size() << " patterns, expected "
+                << testCase.second.size() << std::endl;
+      assert(false);
+    }
+    if (set->isMatch(testCase.first) != !testCase.second.empty()) {
+      std::cout << "Test case " << testCase.first
+                << " FAILED against the regex set" << std::endl;
+      assert(false);
     }
+  }
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-    return false;
+void testPrefilter(const std::string &regex, const std::string &prefix,
+                   const std::string &suffix, const std::string &required) {
+  std::cout << "######## Literals of " << regex << " #########" << std::endl;
+
+  Prefilter prefilter = Prefilter::fromAst(RegexAst::parse(regex));
+
+  if (prefilter.getPrefix() != prefix || prefilter.getSuffix() != suffix ||
+      prefilter.getRequired() != required) {
+    prefilter.print();
+    assert(false);
   }
 
-  void print() {
-    std::cout << "NFA { \n";
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// the vectorized scan has to agree with std::string::find everywhere,
+// including needles that straddle the end of a 16 byte block
+void testFindLiteral() {
+  std::cout << "######## Literal scan #########" << std::endl;
 
-    std::cout << "Final States: \n";
+  std::string haystack;
+  unsigned int seed = 7;
+  for (int i = 0; i < 4096; i++) {
+    seed = seed * 1103515245 + 12345;
+    haystack += static_cast<char>('a' + (seed >> 16) % 4);
+  }
 
-    for (int finalState : this->finalStates) {
-      std::cout << "+ " << finalState << std::endl;
+  for (size_t length = 1; length <= 24; length++) {
+    for (size_t start = 0; start + length <= haystack.size(); start += 97) {
+      std::string needle = haystack.substr(start, length);
+      for (size_t from = 0; from < 40; from += 13) {
+        const char *found = findLiteral(haystack.data() + from,
+                                        haystack.size() - from, needle);
+        size_t expected = haystack.find(needle, from);
+        size_t actual = found == nullptr ? std::string::npos
+                                         : found - haystack.data();
+        if (actual != expected) {
+          std::cout << "Scan for " << needle << " found " << actual
+                    << " expected " << expected << std::endl;
+          assert(false);
+        }
+      }
     }
+  }
 
-    std::cout << "EpsilonTransitions \n";
+  assert(findLiteral(haystack.data(), haystack.size(), "abcdz") == nullptr);
 
-    for (std::pair<int, std::unordered_set<int>> epsilonTransition :
-         this->epsilonTransitions) {
-      std::cout << "+ " << epsilonTransition.first << " -> [ ";
-      for (const int &state : epsilonTransition.second) {
-        std::cout << state << ", ";
-      }
-      std::cout << " ] \n";
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// findAll over input has to report exactly the expected spans
+void testSearch(const std::string &regex, const std::string &input,
+                MatchKind kind, const std::vector<Match> &expected) {
+  std::cout << "######## Search " << regex << " in " << input << " #########"
+            << std::endl;
+
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+
+  std::vector<Match> found = compiled->findAll(input, kind);
+  if (found != expected) {
+    std::cout << "Found " << found.size() << " matches:";
+    for (const Match &match : found) {
+      std::cout << " [" << match.start << ", " << match.end << ")";
     }
+    std::cout << std::endl;
+    assert(false);
+  }
+
+  if (compiled->contains(input) != !expected.empty()) {
+    std::cout << "Unanchored DFA disagrees with the search" << std::endl;
+    assert(false);
+  }
 
-    std::cout << "Transitions \n";
-
-    for (std::pair<int,
-                   std::unordered_map<std::string, std::unordered_set<int>>>
-             transition : this->transitions) {
-      std::cout << "+ From " << transition.first << std::endl;
-      std::cout << "\t";
-      for (std::pair<std::string, std::unordered_set<int>> symbolToStates :
-           transition.second) {
-        std::cout << "Given Symbol " << symbolToStates.first << ": [ ";
-        for (const int &toState : symbolToStates.second) {
-          std::cout << toState << ", ";
+  // an empty input also has to match as a view without data
+  if (input.empty()) {
+    assert(compiled->findAll(std::string_view(), kind) == expected);
+    assert(compiled->contains(std::string_view()) == !expected.empty());
+  }
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// spans found by the forward and reverse DFAs have to be the ones the NFA
+// search reports, for every input over alphabet up to maxLength bytes
+void testReverseSearch(const std::string &regex, const std::string &alphabet,
+                       size_t maxLength) {
+  std::cout << "######## Reverse DFA for " << regex << " #########" << std::endl;
+
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  std::unique_ptr<Nfa> nfa =
+      untraced([&] { return buildNfa(RegexAst::parse(regex)); });
+  assert(compiled->getLeftmostDfa() != nullptr);
+  std::cout << compiled->getLeftmostDfa()->getStateCount()
+            << " forward states, "
+            << compiled->getReverseDfa()->getStateCount()
+            << " reverse states" << std::endl;
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    for (MatchKind kind : {MatchKind::LeftmostFirst,
+                           MatchKind::LeftmostLongest}) {
+      for (size_t from = 0; from <= input.size(); from++) {
+        Match expected;
+        Match found;
+        bool matched = nfa->search(input, from, kind, expected);
+        if (compiled->find(input, found, from, kind) != matched ||
+            (matched && !(found == expected))) {
+          std::cout << "DFAs disagree on " << input << " from " << from
+                    << std::endl;
+          assert(false);
         }
-        std::cout << " ] \n";
       }
     }
+  });
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-    std::cout << "} \n";
+// matches fed chunk by chunk
+std::vector<Match> streamMatches(StreamMatcher &matcher,
+                                 const std::string &input, size_t chunkSize) {
+  std::vector<Match> matches;
+  for (size_t from = 0; from < input.size(); from += chunkSize) {
+    std::vector<Match> found = matcher.feed(input.substr(from, chunkSize));
+    matches.insert(matches.end(), found.begin(), found.end());
   }
-};
+  std::vector<Match> found = matcher.finish();
+  matches.insert(matches.end(), found.begin(), found.end());
+  return matches;
+}
 
-std::vector<std::string> preProcessRegex(const std::string &regex) {
-  std::vector<std::string> splitted;
-  std::string builder;
-  for (char curr : regex) {
-    if (isOperatorOrGroups(curr)) {
-      if (!builder.empty()) {
-        splitted.push_back(builder);
+// a stream cut into chunks of any size has to report what findAll reports
+// for it, for every input over alphabet up to maxLength bytes
+void testStream(const std::string &regex, const std::string &alphabet,
+                size_t maxLength) {
+  std::cout << "######## Stream for " << regex << " #########" << std::endl;
+
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    for (MatchKind kind : {MatchKind::LeftmostFirst,
+                           MatchKind::LeftmostLongest}) {
+      std::vector<Match> expected = compiled->findAll(input, kind);
+      StreamMatcher matcher(*compiled, kind);
+      for (size_t chunkSize : {1, 2, 3, 64}) {
+        if (streamMatches(matcher, input, chunkSize) != expected) {
+          std::cout << "Stream disagrees on " << input << " in chunks of "
+                    << chunkSize << std::endl;
+          assert(false);
+        }
       }
-      builder.clear();
-      // insert the delimitter
-      splitted.push_back(std::string(1, curr));
+    }
+  });
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// a log far larger than the lookahead, fed in chunks of random sizes, has to
+// give the matches of findAll while keeping at most maxLookahead bytes
+void testStreamLog(const std::string &regex) {
+  std::cout << "######## Stream a log for " << regex << " #########"
+            << std::endl;
+
+  std::mt19937 random(7);
+  std::string log;
+  while (log.size() < 1 << 20) {
+    int kind = random() % 8;
+    std::string number = std::to_string(random() % 100000);
+    if (kind == 0) {
+      log += "ERROR " + number + ": disk quota exceeded\n";
+    } else if (kind == 1) {
+      log += "WARN " + number + ": retrying heartbeat\n";
     } else {
-      builder += curr;
+      log += "INFO " + number + ": request served in " + number + "ms\n";
     }
   }
 
-  if (!builder.empty()) {
-    splitted.push_back(builder);
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  std::vector<Match> expected = compiled->findAll(log);
+
+  size_t maxLookahead = 256;
+  traceCompilation = false;
+  StreamMatcher matcher(*compiled, MatchKind::LeftmostFirst, maxLookahead);
+  traceCompilation = true;
+  std::vector<Match> matches;
+  size_t maxBuffered = 0;
+  for (size_t from = 0; from < log.size();) {
+    size_t chunkSize = 1 + random() % 9000;
+    std::vector<Match> found =
+        matcher.feed(std::string_view(log).substr(from, chunkSize));
+    matches.insert(matches.end(), found.begin(), found.end());
+    maxBuffered = std::max(maxBuffered, matcher.getBuffered());
+    from += chunkSize;
+    assert(matcher.getOffset() == std::min(from, log.size()));
   }
+  std::vector<Match> found = matcher.finish();
+  matches.insert(matches.end(), found.begin(), found.end());
+
+  std::cout << engineName(compiled->getPlan().find) << ", " << matches.size()
+            << " matches, at most " << maxBuffered
+            << " bytes buffered" << std::endl;
+  assert(matches == expected);
+  assert(maxBuffered <= 2 * maxLookahead + 1);
+
+  // a match that could still grow after the lookahead is reported as it is
+  std::unique_ptr<Regex> stalled =
+      untraced([&] { return Regex::compile("ab*c|a"); });
+  StreamMatcher cut(*stalled, MatchKind::LeftmostFirst, 4);
+  std::vector<Match> early = cut.feed("a" + std::string(1000, 'b'));
+  assert(early.size() == 1 && early[0] == (Match{0, 1}));
+  assert(cut.getBuffered() <= 2 * 4 + 1);
 
-  int uniqueness = 0;
-  for (std::string &section : splitted) {
-    if (!isOperatorOrGroups(section)) {
-      section += "_" + std::to_string(uniqueness);
-      uniqueness++;
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// the Aho-Corasick automaton has to agree with the NFA on full matches,
+// containment and the spans of both kinds of search
+void testAhoCorasick(const std::string &regex, const std::string &alphabet,
+                     size_t maxLength) {
+  std::cout << "######## Aho-Corasick for " << regex << " #########"
+            << std::endl;
+
+  RegexAst ast = RegexAst::parse(regex);
+  std::unique_ptr<Nfa> nfa = untraced([&] { return buildNfa(ast); });
+  std::unique_ptr<AhoCorasick> automaton = AhoCorasick::fromAst(ast);
+  assert(automaton != nullptr);
+  std::cout << automaton->getLiteralCount() << " literals in "
+            << automaton->getStateCount() << " states" << std::endl;
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    Match expected;
+    if (automaton->runSimulation(input) != nfa->runSimulation(input) ||
+        automaton->contains(input) !=
+            nfa->search(input, 0, MatchKind::LeftmostFirst, expected)) {
+      std::cout << "Aho-Corasick disagrees on " << input << std::endl;
+      assert(false);
     }
-  }
-  return splitted;
-}
-
-std::vector<std::string>
-infixToPostFixTranslation(std::vector<std::string> infix) {
-  std::vector<std::string> pushers =
-      std::vector<std::string>{"+", "|", "(", "*"};
-  std::string popOn = ")";
-
-  std::vector<std::string> outputQueue;
-  std::vector<std::string> stack;
-
-  for (const std::string &candidate : infix) {
-    std::vector<std::string>::iterator it =
-        std::find(pushers.begin(), pushers.end(), candidate);
-    if (it != pushers.end()) {
-      stack.push_back(candidate);
-    } else if (candidate == popOn) {
-      // while the stack is not empty and the current top most element is an
-      // operator of higher than the left one keep popping the top of
-      while (!stack.empty()) {
-        std::string top = stack[stack.size() - 1];
-        if (top == "(") {
-          stack.pop_back();
-          break;
-        } else {
-          outputQueue.push_back(top);
-          stack.pop_back();
+    for (MatchKind kind : {MatchKind::LeftmostFirst,
+                           MatchKind::LeftmostLongest}) {
+      for (size_t from = 0; from <= input.size(); from++) {
+        Match found;
+        bool matched = nfa->search(input, from, kind, expected);
+        if (automaton->find(input, from, kind, found) != matched ||
+            (matched && !(found == expected))) {
+          std::cout << "Aho-Corasick disagrees on " << input << " from "
+                    << from << std::endl;
+          assert(false);
         }
       }
-    } else {
-      outputQueue.push_back(candidate);
     }
+  });
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// a list of fifty thousand words compiles to an Aho-Corasick automaton
+// instead of an NFA forking into every one of them
+void testKeywordList() {
+  std::cout << "######## Keyword list #########" << std::endl;
+
+  std::vector<std::string> words;
+  std::string pattern;
+  for (int i = 0; i < 50000; i++) {
+    words.push_back("w" + std::to_string(i * 7919 % 100000) + "x");
+    pattern += (i == 0 ? "" : "|") + words.back();
   }
 
-  // Anything remaining on stack?
-  while (!stack.empty()) {
-    if (stack[stack.size() - 1] == "(") {
-      std::__throw_invalid_argument("Invalid regex");
-    }
-    outputQueue.push_back(stack[stack.size() - 1]);
-    stack.pop_back();
-  }
-
-  std::cout << "POSTFIX: ";
-  for (const std::string &i : outputQueue) {
-    std::cout << i;
-  }
-
-  std::cout << "\n";
-  return outputQueue;
-}
-
-// Create an NFA and change its topology as we iterate through the regular
-// expression return the NFA back to the invoker. This Nfa now has all the
-// states and transitions needed to be able to match a pattern
-std::unique_ptr<Nfa> buildNfa(std::vector<std::string> postFixed) {
-  // all our primitive operators can be treated as binary so I will
-  // solve them the same way we do mathematical binary operators at
-  // this point we can only have primitive operators of Concatenation
-  // and alternations infix to postfix took care of handling groupings
-  std::unique_ptr<Nfa> nfa = Nfa::createEpsilonNfa();
-
-  const int lastStateStart = nfa->startState;
-  int lastStateEnd = nfa->endAcceptanceState;
-
-  std::unordered_map<std::string, std::pair<int, int>> symbolMapping;
-  int i = 0;
-  for (const std::string &candidate : postFixed) {
-    if (!isOperatorOrGroups(candidate)) {
-      int startState = nfa->createNewState();
-      int endState = nfa->createNewState();
-
-      std::pair<int, int> startEndStatePair =
-          std::make_pair(startState, endState);
-      // remove the issue of having a candidate get demolished by the index of
-      // duplicates
-      std::string uniqueCandidate = candidate + std::to_string(i);
-      symbolMapping.insert(std::make_pair(candidate, startEndStatePair));
-      // these are the actual non epsilon transitions
-      // in the actual transition remove the uniqueness postfix
-      std::string postFixedRemoved = candidate.substr(0, 1);
-      nfa->addTransition(startState, postFixedRemoved, endState);
-      // when we iterate over our actual regex we will be adding these real
-      // transitions between the existing start and end state to create
-      // topologies that reflect the expressions and sub-expressions
-      i++;
-    }
+  std::unique_ptr<Regex> keywords =
+      untraced([&] { return Regex::compile(pattern); });
+  assert(keywords->usesAhoCorasick());
+  assert(keywords->getPlan().find == Engine::AhoCorasick);
+  assert(keywords->getMemoryUsed() < (16 << 20));
+  for (size_t i = 0; i < words.size(); i += 997) {
+    assert(keywords->isMatch(words[i]));
+    assert(!keywords->isMatch(words[i] + "x"));
   }
+  assert(!keywords->isMatch("w"));
 
-  std::vector<std::string> stack;
+  std::string text(1000, '.');
+  assert(!keywords->contains(text + "w100001x" + text));
+  text += words[123] + text + "w" + words[456] + text;
+  assert(keywords->contains(text));
+  std::vector<Match> found = keywords->findAll(text);
+  assert(found.size() == 2);
+  assert(found[0].start == 1000 && found[0].end == 1000 + words[123].size());
+  assert(found[1].start == text.find(words[456]));
 
-  for (const std::string &primitiveCandidate : postFixed) {
-    if (primitiveCandidate == "|") {
-      // pop the last two
-      std::string y = stack.at(stack.size() - 1);
-      stack.pop_back();
+  // short lists keep their DFA
+  assert(!Regex::compile("he|she|his|hers")->usesAhoCorasick());
 
-      std::string x = stack.at(stack.size() - 1);
-      stack.pop_back();
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      // make a fork connecting the alternator
-      // x and y represent a state, this state is already in our symbol mapping
-      std::pair<int, int> statesForMatchX = symbolMapping.at(x);
-      std::pair<int, int> statesForMatchY = symbolMapping.at(y);
+// findGroups has to place the groups of the first match as expected, npos
+// marks a group that did not take part
+void testCaptures(const std::string &regex, const std::string &input,
+                  const std::vector<Match> &expected) {
+  std::cout << "######## Captures of " << regex << " in " << input
+            << " #########" << std::endl;
+
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+
+  std::vector<Match> groups;
+  bool found = compiled->findGroups(input, groups);
+  if (found != !expected.empty() || (found && groups != expected)) {
+    std::cout << "Found";
+    for (const Match &group : groups) {
+      std::cout << " [" << group.start << ", " << group.end << ")";
+    }
+    std::cout << std::endl;
+    assert(false);
+  }
 
-      // when doing a fork we basically break the connection between the current
-      // start state and end state then we add our fork in between
-      int preForkCommonState = nfa->createNewState();
-      int postForkCommonState = nfa->createNewState();
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      // create the alternator
-      nfa->addEpsilonTransition(preForkCommonState, statesForMatchX.first);
-      nfa->addEpsilonTransition(preForkCommonState, statesForMatchY.first);
+// the PikeVm has to find the spans of the NFA search, and findGroups and
+// matchGroups, one-pass or not, the groups of the PikeVm, for every input
+// over alphabet up to maxLength bytes
+void testCaptureEngines(const std::string &regex, const std::string &alphabet,
+                        size_t maxLength, bool onePass) {
+  std::cout << "######## Capture engines for " << regex << " #########"
+            << std::endl;
 
-      if (nfa->hasEpsilonTransitions(statesForMatchX.second)) {
-        std::cout << "Attempt transfer from " << statesForMatchX.second
-                  << " to " << postForkCommonState << std::endl;
-        nfa->transferEpsilonTransitions(statesForMatchX.second,
-                                        postForkCommonState);
+  RegexAst ast = RegexAst::parse(regex);
+  std::unique_ptr<Nfa> nfa = untraced([&] { return buildNfa(ast); });
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  std::unique_ptr<PikeVm> vm = PikeVm::fromAst(ast);
+  assert((compiled->getOnePassDfa() != nullptr) == onePass);
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    std::vector<Match> expected;
+    std::vector<Match> groups;
+    bool matched = vm->fullMatch(input, expected);
+    if (matched != nfa->runSimulation(input) ||
+        compiled->matchGroups(input, groups) != matched ||
+        (matched && groups != expected)) {
+      std::cout << "Full match disagrees on " << input << std::endl;
+      assert(false);
+    }
+    for (size_t from = 0; from <= input.size(); from++) {
+      Match match;
+      matched = vm->search(input, from, expected);
+      if (matched != nfa->search(input, from, MatchKind::LeftmostFirst,
+                                 match) ||
+          (matched && !(expected[0] == match)) ||
+          compiled->findGroups(input, groups, from) != matched ||
+          (matched && groups != expected)) {
+        std::cout << "Search disagrees on " << input << " from " << from
+                  << std::endl;
+        assert(false);
       }
+    }
+  });
 
-      // when we do a concat, and then another concat and then do an alternator
-      // the concats are sequenced.... this aint good
-      if (nfa->hasEpsilonTransitions(statesForMatchY.second)) {
-        std::cout << "Attempt transfer from " << statesForMatchY.second
-                  << " to " << postForkCommonState << std::endl;
-        nfa->transferEpsilonTransitions(statesForMatchY.second,
-                                        postForkCommonState);
-      }
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      nfa->addEpsilonTransition(statesForMatchX.second, postForkCommonState);
-      nfa->addEpsilonTransition(statesForMatchY.second, postForkCommonState);
+// the planner has to pick the expected engines, and whatever they are they
+// have to agree with the NFA on every input
+void testPlan(const std::string &regex, Engine isMatch, Engine contains,
+              Engine find, Engine groups,
+              const std::vector<std::string> &inputs) {
+  std::cout << "######## Plan for " << regex << " #########" << std::endl;
+
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  const RegexPlan &plan = compiled->getPlan();
+  std::cout << plan.toString() << std::endl;
+  assert(plan.isMatch == isMatch);
+  assert(plan.contains == contains);
+  assert(plan.find == find);
+  assert(plan.groups == groups);
+
+  if (plan.find == Engine::None) {
+    std::cout << "-------- Test Passes ---------" << std::endl;
+    return;
+  }
+  std::unique_ptr<Nfa> nfa =
+      untraced([&] { return buildNfa(RegexAst::parse(regex)); });
+  for (const std::string &input : inputs) {
+    Match expected;
+    Match match;
+    bool found = nfa->search(input, 0, MatchKind::LeftmostFirst, expected);
+    assert(compiled->isMatch(input) == nfa->runSimulation(input));
+    assert(compiled->contains(input) == found);
+    assert(compiled->find(input, match) == found);
+    assert(!found || match == expected);
+  }
 
-      // find the x and y states start and ends for both and then create an
-      // alternator then take their combined start and end and store in the
-      // mapping
-      std::string alternated = "(" + x + ")|(" + y + ")";
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      // add the state and metadata back into mappings
-      symbolMapping.insert(std::make_pair(
-          alternated, std::make_pair(preForkCommonState, postForkCommonState)));
+// isMatch on a pattern without a DFA has to keep its lazy DFA between
+// calls, one per thread matching at the same time
+void testLazyDfaPool() {
+  std::cout << "######## Lazy DFA pool #########" << std::endl;
+
+  std::string regex = "(a|b)*a(a|b){80}";
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  std::unique_ptr<Nfa> nfa =
+      untraced([&] { return buildNfa(RegexAst::parse(regex)); });
+  assert(compiled->getPlan().isMatch == Engine::LazyDfa);
+  assert(compiled->getLazyDfaCount() == 0);
+
+  std::string input = "ba" + std::string(80, 'b');
+  assert(compiled->isMatch(input));
+  assert(compiled->getLazyDfaCount() == 1);
+  int states = compiled->getLazyDfaStateCount();
+  assert(states > 2);
+
+  // the same input again only takes transitions that are already cached
+  assert(compiled->isMatch(input));
+  assert(compiled->getLazyDfaCount() == 1);
+  assert(compiled->getLazyDfaStateCount() == states);
+
+  std::vector<std::string> inputs;
+  for (int i = 0; i < 5000; i++) {
+    std::string word;
+    for (int j = 0; j < 81 + i % 7; j++) {
+      word += (i * 31 + j * j) % 5 == 0 ? 'b' : 'a';
+    }
+    inputs.push_back(word);
+  }
+  std::vector<std::string_view> views(inputs.begin(), inputs.end());
+  MatchBitmap matched = compiled->matchMany(views, 8);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    assert(matched.test(i) == nfa->runSimulation(inputs[i]));
+  }
+  std::cout << compiled->getLazyDfaCount() << " lazy DFAs with "
+            << compiled->getLazyDfaStateCount() << " states" << std::endl;
+  // threads beyond the pool size drop their caches, which the memory
+  // reported from compile on already covers
+  assert(compiled->getLazyDfaCount() <= 4);
+  assert(compiled->getMemoryUsed() > (4 << 20));
 
-      stack.push_back(alternated);
-    } else if (primitiveCandidate == "+") {
-      // pop the last two
-      std::string y = stack.at(stack.size() - 1);
-      stack.pop_back();
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      std::string x = stack.at(stack.size() - 1);
-      stack.pop_back();
+// chunked matching has to agree with the sequential scan for any thread count
+void testParallel(const std::string &regex,
+                  const std::vector<std::string> &inputs) {
+  std::cout << "######## Parallel " << regex << " #########" << std::endl;
 
-      // x and y represent a state, this state is already in our symbol mapping
-      std::pair<int, int> statesForMatchX = symbolMapping.at(x);
-      std::pair<int, int> statesForMatchY = symbolMapping.at(y);
+  std::unique_ptr<Nfa> nfa =
+      untraced([&] { return buildNfa(RegexAst::parse(regex)); });
+  std::unique_ptr<Dfa> dfa = Dfa::minimize(*Dfa::fromNfa(*nfa));
 
-      if (nfa->hasEpsilonTransitions(statesForMatchX.second)) {
-        nfa->transferEpsilonTransitions(statesForMatchX.second,
-                                        statesForMatchY.second);
-      }
-      // connect x and y
-      nfa->addEpsilonTransition(statesForMatchX.second, statesForMatchY.first);
+  for (const std::string &input : inputs) {
+    bool expected = dfa->runSimulation(input);
+    for (int threads : {1, 2, 4, 7}) {
+      assert(dfa->runSimulationParallel(input, threads, 16) == expected);
+    }
+  }
 
-      std::string concatenated = "(" + x + ")+(" + y + ")";
-      symbolMapping.insert(
-          std::make_pair(concatenated, std::make_pair(statesForMatchX.first,
-                                                      statesForMatchY.second)));
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      stack.push_back(concatenated);
-    } else if (primitiveCandidate == "*") {
-      // Kleene is a unary and is to be treated differently
-      std::string x = stack.at(stack.size() - 1);
-      stack.pop_back();
+// the batch API has to agree with isMatch for every input and thread count
+void testMatchMany(const std::string &regex,
+                   const std::vector<std::string> &cases) {
+  std::cout << "######## Match many " << regex << " #########" << std::endl;
 
-      std::pair<int, int> statesForMatchX = symbolMapping.at(x);
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
 
-      // construct a kleene then add it into the nfa
-      int preForkCommonState = nfa->createNewState();
-      int pseudoEnd = nfa->createNewState();
+  // enough inputs to spread over several blocks, with a partial last one
+  std::vector<std::string_view> inputs;
+  for (int i = 0; i < 5000; i++) {
+    inputs.push_back(cases[(i * 7) % cases.size()]);
+  }
 
-      // transfer everything in second to pseudoEnd
-      if (nfa->hasEpsilonTransitions(statesForMatchX.second)) {
-        nfa->transferEpsilonTransitions(statesForMatchX.second, pseudoEnd);
-      }
+  for (int threads : {1, 3, 8}) {
+    MatchBitmap matched = compiled->matchMany(inputs, threads);
+    assert(matched.size() == inputs.size());
+    size_t expectedCount = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      assert(matched.test(i) == compiled->isMatch(inputs[i]));
+      expectedCount += matched.test(i);
+    }
+    assert(matched.count() == expectedCount);
+  }
+  assert(compiled->matchMany({}, 4).size() == 0);
+
+  // batches narrower than the interleaved lanes, and lanes refilled after
+  // an empty or short input
+  for (size_t count = 1; count <= 3 * Dfa::interleaveWidth; count++) {
+    std::span<const std::string_view> batch(inputs.data(), count);
+    MatchBitmap matched = compiled->matchMany(batch);
+    for (size_t i = 0; i < count; i++) {
+      assert(matched.test(i) == compiled->isMatch(batch[i]));
+    }
+  }
 
-      nfa->addEpsilonTransition(statesForMatchX.second, pseudoEnd);
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      // loop back on the kleene
-      nfa->addEpsilonTransition(statesForMatchX.second, statesForMatchX.first);
-      nfa->addEpsilonTransition(preForkCommonState, pseudoEnd);
-      nfa->addEpsilonTransition(preForkCommonState, statesForMatchX.first);
+// the machine code has to agree with the table driven DFA on every input,
+// including states wide enough to go through a jump table
+void testJit(const std::string &regex, const std::string &alphabet) {
+  std::cout << "######## JIT " << regex << " #########" << std::endl;
 
-      std::string kleene = "(" + x + "*)";
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex, true); });
+  std::unique_ptr<Regex> interpreted =
+      untraced([&] { return Regex::compile(regex); });
 
-      symbolMapping.insert(std::make_pair(
-          kleene, std::make_pair(preForkCommonState, pseudoEnd)));
+  if (!compiled->isJitCompiled()) {
+    std::cout << "No JIT on this platform" << std::endl;
+    std::cout << "-------- Test Passes ---------" << std::endl;
+    return;
+  }
 
-      stack.push_back(kleene);
+  forEachInput(alphabet, 4, [&](const std::string &input) {
+    assert(compiled->isMatch(input) == interpreted->isMatch(input));
+  });
 
-    } else {
-      stack.push_back(primitiveCandidate);
-    }
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-    std::cout << "State of NFA" << std::endl;
-    nfa->print();
+template <FixedString Pattern> struct StaticMatcher {
+  bool runSimulation(const std::string &input) const {
+    return staticMatch<Pattern>(input);
   }
+};
 
-  // connect everything in stack as concat on main NFA
-  if (stack.size() > 0) {
-    std::cout << "Concatenating Remaining Sub-Automatas" << std::endl;
-    while (!stack.empty()) {
-      std::string x = stack.at(stack.size() - 1);
-      stack.pop_back();
+// the automaton built during compilation has to accept the same inputs
+template <FixedString Pattern>
+void testStatic(const std::vector<std::string> &matches,
+                const std::vector<std::string> &notMatches) {
+  StaticMatcher<Pattern> matcher;
+  std::string regex(Pattern.view());
+  evaluate("Static DFA", regex, matcher, matches, notMatches);
+  std::cout << "Static DFA for " << regex << " has "
+            << staticDfa<Pattern>.getStateCount() << " states" << std::endl;
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      std::pair<int, int> xState = symbolMapping.at(x);
+// the static parser has to read regex the way RegexAst does: the DFA it
+// builds, run here outside of compilation, has to agree with Regex on every
+// input over alphabet up to maxLength bytes
+void testStaticParser(const std::string &regex, const std::string &alphabet,
+                      size_t maxLength) {
+  std::cout << "######## Static parser for " << regex << " #########"
+            << std::endl;
 
-      nfa->removeEpsilonTransition(lastStateStart, lastStateEnd);
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  StaticDfaBuilder built = determinizeStatic(regex);
 
-      nfa->addEpsilonTransition(lastStateStart, xState.first);
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    int state = 1;
+    for (unsigned char c : input) {
+      state = built.transitions[state * built.classCount + built.classOf[c]];
+    }
+    if (static_cast<bool>(built.accepting[state]) !=
+        compiled->isMatch(input)) {
+      std::cout << "Parsers disagree on " << input << std::endl;
+      assert(false);
+    }
+  });
 
-      nfa->addEpsilonTransition(xState.second, lastStateEnd);
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-      lastStateEnd = xState.first;
-    }
+// valid for RegexAst but outside of what staticMatch accepts, which has to
+// fail the build instead of being read some other way
+void testStaticRejects(const std::string &regex) {
+  std::cout << "######## Static parser rejects " << regex << " #########"
+            << std::endl;
+
+  RegexAst::parse(regex);
+  assert(staticRejects(regex));
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
+
+// the n-th character from the end is an a: the DFA needs 2^n states, far
+// beyond Regex::maxDfaStates, while the Glushkov automaton has 2n + 1
+// positions
+void testNthFromEnd(int n) {
+  std::cout << "######## " << n << "th character from the end #########"
+            << std::endl;
+
+  std::string regex = "((a|b)*)+a";
+  for (int i = 1; i < n; i++) {
+    regex += "+(a|b)";
   }
 
-  return nfa;
+  std::unique_ptr<Regex> compiled =
+      untraced([&] { return Regex::compile(regex); });
+  std::unique_ptr<GlushkovNfa> glushkov =
+      untraced([&] { return GlushkovNfa::fromAst(RegexAst::parse(regex)); });
+  assert(glushkov != nullptr);
+  assert(glushkov->getPositionCount() == 2 * n + 1);
+
+  std::string tail(n - 1, 'b');
+  std::string longPrefix(1000, 'b');
+  assert(compiled->isMatch("a" + tail));
+  assert(compiled->isMatch(longPrefix + "a" + tail));
+  assert(compiled->isMatch("ba" + std::string(n - 1, 'a')));
+  assert(!compiled->isMatch(tail));
+  assert(!compiled->isMatch("a" + tail + "b"));
+  assert(!compiled->isMatch(longPrefix + "b" + tail));
+  assert(!compiled->isMatch("a" + tail + "c"));
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
 }
 
-void test(const std::string &regex, std::vector<std::string> matches,
-          std::vector<std::string> notMatches) {
-  std::cout << "INFIX Regex: " << regex << std::endl;
+// counters have to agree with the repeats written out, as a full match and
+// as a search, on every input over alphabet up to maxLength bytes
+void testCounting(const std::string &regex, const std::string &alphabet,
+                  size_t maxLength) {
+  std::cout << "######## Counters for " << regex << " #########" << std::endl;
+
+  RegexAst ast = RegexAst::parse(regex);
+  std::unique_ptr<Nfa> nfa = untraced([&] { return buildNfa(ast); });
+  std::unique_ptr<CountingNfa> counting = CountingNfa::fromAst(ast);
+  std::cout << counting->getCounterCount() << " counters in "
+            << counting->getStateCount() << " states, written out "
+            << nfa->getStateCount() << " states" << std::endl;
+
+  forEachInput(alphabet, maxLength, [&](const std::string &input) {
+    Match match;
+    bool found = nfa->search(input, 0, MatchKind::LeftmostFirst, match);
+    if (counting->runSimulation(input) != nfa->runSimulation(input) ||
+        counting->contains(input) != found) {
+      std::cout << "Counters disagree on " << input << std::endl;
+      assert(false);
+    }
+  });
 
-  std::cout << "######## COMPILE TO NFA ########" << std::endl;
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-  std::vector<std::string> processed = preProcessRegex(regex);
-  std::vector<std::string> postFixed = infixToPostFixTranslation(processed);
+// counts far beyond what can be written out compile to a handful of states
+void testLargeRepeats() {
+  std::cout << "######## Large repeats #########" << std::endl;
+
+  traceCompilation = false;
+  std::unique_ptr<Regex> digits = Regex::compile("[0-9]{1,100000}");
+  assert(digits->usesCounters());
+  assert(digits->getMemoryUsed() < 4096);
+  std::string manyDigits(100000, '7');
+  assert(digits->isMatch(manyDigits));
+  assert(!digits->isMatch(manyDigits + "7"));
+  assert(!digits->isMatch(""));
+  assert(!digits->isMatch("12a"));
+
+  std::unique_ptr<Regex> window = Regex::compile("x.{0,200000}y");
+  assert(window->usesCounters());
+  assert(window->contains("..x" + std::string(1000, 'z') + "y.."));
+  assert(window->contains("x" + std::string(200000, 'z') + "y"));
+  assert(!window->contains("x" + std::string(200001, 'z') + "y"));
+  assert(!window->contains("y" + std::string(1000, 'z') + "x"));
+  assert(!window->contains("x\ny"));
+
+  std::unique_ptr<Regex> fields = Regex::compile("(\\d{1,70000},)*\\d{3,}");
+  assert(fields->usesCounters());
+  assert(fields->isMatch("1,22,333"));
+  assert(fields->isMatch(std::string(70000, '1') + ",4444"));
+  assert(!fields->isMatch(std::string(70001, '1') + ",4444"));
+  assert(!fields->isMatch("1,22,"));
+  assert(!fields->isMatch("12"));
+
+  bool threw = false;
+  Match match;
+  try {
+    fields->find("1,22,333", match);
+  } catch (const std::logic_error &error) {
+    threw = true;
+  }
+  assert(threw);
+
+  // repeats of longer operands are still written out, counters or not
+  threw = false;
+  try {
+    Regex::compile("(ab){1000}{1000}");
+  } catch (const std::invalid_argument &error) {
+    std::cout << error.what() << std::endl;
+    threw = true;
+  }
+  assert(threw);
+  traceCompilation = true;
 
-  std::unique_ptr<Nfa> nfa = buildNfa(postFixed);
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-  std::cout << "######## Completed Nfa: for " << regex << " #########"
-            << std::endl;
+// repeated compiles of a pattern share one Regex until it is evicted
+void testRegexCache() {
+  std::cout << "######## Regex cache #########" << std::endl;
+
+  traceCompilation = false;
+
+  RegexCache cache(2);
+  std::shared_ptr<const Regex> first = cache.get("a+b");
+  assert(cache.get("a+b") == first);
+  assert(cache.get("a+b", true) != first);
+  assert(cache.getHitCount() == 1 && cache.getMissCount() == 2);
+
+  // touching a+b makes (c|o)* the oldest entry
+  cache.get("a+b");
+  cache.get("(c|o)*");
+  assert(cache.size() == 2 && cache.getEvictionCount() == 1);
+  assert(cache.get("a+b") == first);
+  cache.get("d+(a*)");
+  assert(cache.getEvictionCount() == 2);
+  assert(cache.get("a+b") == first);
+  assert(first->isMatch("ab"));
+
+  bool threw = false;
+  try {
+    cache.get("(a+b");
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  assert(threw && cache.size() == 2);
+
+  // a budget smaller than any regex still keeps the latest one
+  RegexCache tiny(100, 1);
+  tiny.get("a+b");
+  tiny.get("a|b");
+  assert(tiny.size() == 1 && tiny.getMemoryUsed() > 1);
+
+  RegexCache shared(4);
+  std::vector<std::string> patterns = {"a+b", "a|b", "(c|o)*", "d+(a*)",
+                                       "c+(o)*", "(c+d)*"};
+  std::vector<std::thread> workers;
+  for (int thread = 0; thread < 4; thread++) {
+    workers.push_back(std::thread([&shared, &patterns, thread] {
+      for (int i = 0; i < 1000; i++) {
+        std::shared_ptr<const Regex> regex =
+            shared.get(patterns[(i + thread) % patterns.size()]);
+        assert(regex->isMatch("cd") == (regex->getPattern() == "(c+d)*"));
+      }
+    }));
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  assert(shared.getHitCount() + shared.getMissCount() == 4000);
+  assert(shared.size() <= 4);
 
-  nfa->print();
+  traceCompilation = true;
+
+  std::cout << "-------- Test Passes ---------" << std::endl;
+}
 
-  std::cout << "######## Evaluate against NFA #########" << std::endl;
+// automata loaded from a file have to answer like the regexes written to it
+void testAutomatonFile(const std::vector<std::string> &patterns,
+                       const std::vector<std::string> &inputs) {
+  std::cout << "######## Automaton file #########" << std::endl;
+
+  traceCompilation = false;
+  std::vector<std::unique_ptr<Regex>> compiled;
+  std::vector<const Regex *> rules;
+  for (const std::string &pattern : patterns) {
+    compiled.push_back(Regex::compile(pattern));
+    rules.push_back(compiled.back().get());
+  }
+  traceCompilation = true;
+
+  std::string path =
+      (std::filesystem::temp_directory_path() / "regex_automata_test.bin")
+          .string();
+  assert(AutomatonFile::write(path, rules));
+
+  std::unique_ptr<AutomatonFile> automata = AutomatonFile::open(path);
+  assert(automata != nullptr && automata->size() == patterns.size());
+  for (size_t rule = 0; rule < patterns.size(); rule++) {
+    assert(automata->getPattern(rule) == patterns[rule]);
+
+    DfaView fullMatch;
+    DfaView search;
+    assert(automata->getFullMatchDfa(rule, fullMatch) ==
+           (rules[rule]->getDfa() != nullptr));
+    assert(automata->getSearchDfa(rule, search) ==
+           (rules[rule]->getUnanchoredDfa() != nullptr));
+    for (const std::string &input : inputs) {
+      if (rules[rule]->getDfa() != nullptr) {
+        bool matches = rules[rule]->isMatch(input);
+        assert(fullMatch.runSimulation(input) == matches);
+        assert(fullMatch.getAcceptId(input) == (matches ? int(rule) : -1));
+      }
+      if (rules[rule]->getUnanchoredDfa() != nullptr) {
+        assert(search.runSimulation(input) == rules[rule]->contains(input));
+      }
+    }
 
-  for (const std::string &trues : matches) {
-    bool mustBeTrue = nfa->runSimulation(trues);
-    if (!mustBeTrue) {
-      std::cout << "Test case " << trues << " FAILED against Regex " << regex
-                << std::endl;
-      assert(false);
+    // later loads skip the table check and give the same view
+    DfaView again;
+    if (automata->getFullMatchDfa(rule, again)) {
+      for (const std::string &input : inputs) {
+        assert(again.getAcceptId(input) == fullMatch.getAcceptId(input));
+      }
     }
   }
 
-  for (const std::string &falses : notMatches) {
-    bool mustBeFalse = nfa->runSimulation(falses);
-    if (mustBeFalse) {
-      std::cout << "Test case " << falses << " FAILED against Regex " << regex
-                << std::endl;
-      assert(false);
+  // truncated files and files of another version are refused
+  std::string contents = AutomatonFile::serialize(rules);
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(contents.data(), contents.size() - 8);
+  assert(AutomatonFile::open(path) == nullptr);
+  contents[8]++;
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(contents.data(), contents.size());
+  assert(AutomatonFile::open(path) == nullptr);
+
+  // so are DFAs whose tables lead outside of them, once they are loaded
+  contents[8]--;
+  AutomatonRuleEntry entry;
+  std::memcpy(&entry, contents.data() + sizeof(AutomatonFileHeader),
+              sizeof(entry));
+  assert(entry.fullMatchOffset != 0);
+  AutomatonDfaHeader header;
+  std::memcpy(&header, contents.data() + entry.fullMatchOffset,
+              sizeof(header));
+  size_t classesAt = entry.fullMatchOffset + sizeof(header);
+  size_t transitionsAt = classesAt + 256;
+  size_t acceptIdsAt = transitionsAt + sizeof(int32_t) * header.stateCount *
+                                           header.classCount;
+  int32_t outside = header.stateCount;
+  int32_t otherRule = 7;
+  for (size_t corrupt = 0; corrupt < 3; corrupt++) {
+    std::string damaged = contents;
+    if (corrupt == 0) {
+      std::memcpy(damaged.data() + transitionsAt, &outside, sizeof(outside));
+    } else if (corrupt == 1) {
+      damaged[classesAt + 'a'] = static_cast<char>(header.classCount);
+    } else {
+      std::memcpy(damaged.data() + acceptIdsAt, &otherRule,
+                  sizeof(otherRule));
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(damaged.data(), damaged.size());
+    std::unique_ptr<AutomatonFile> corrupted = AutomatonFile::open(path);
+    assert(corrupted != nullptr);
+    // a DFA that failed the check is not marked as checked
+    for (int attempt = 0; attempt < 2; attempt++) {
+      DfaView view;
+      bool thrown = false;
+      try {
+        corrupted->getFullMatchDfa(0, view);
+      } catch (const std::runtime_error &) {
+        thrown = true;
+      }
+      assert(thrown);
     }
   }
 
+  std::remove(path.c_str());
+  assert(AutomatonFile::open(path) == nullptr);
+
   std::cout << "-------- Test Passes ---------" << std::endl;
 }
 
 int main() {
+  traceCompilation = true;
+
   std::cout << "############ REGULAR EXPRESSION PARSER & COMPILER #############"
             << std::endl;
 
@@ -652,7 +1194,7 @@ int main() {
   std::string altConCombo1Regex = "(a+b)|(c+d)";
   std::vector<std::string> altConCombo1Falses = {"",  "a",  "b",  "c",
                                                  "d", "ac", "ad", "dca"};
-  std::vector<std::string> altConCombo1Trues = {}; // {"ab", "cd"};
+  std::vector<std::string> altConCombo1Trues = {"ab", "cd"};
 
   test(altConCombo1Regex, altConCombo1Trues, altConCombo1Falses);
 
@@ -728,8 +1270,8 @@ int main() {
   test(allCombo2, allCombo2Trues, allCombo2Falses);
 
   // all pattern mega regex
-  std::string finalTestRegex = "k+h+a+l+i+d+.+h+a+m+d+(a*)+n+@+((g+m+a+i+l)|(m+"
-                               "i+c+r+o+s+o+f+t))+.+c+o+m";
+  std::string finalTestRegex = "k+h+a+l+i+d+\\.+h+a+m+d+(a*)+n+@+((g+m+a+i+"
+                               "l)|(m+i+c+r+o+s+o+f+t))+\\.+c+o+m";
   std::vector<std::string> finalTestRegexFalses = {"khalid.hamdaan@yahoo.com",
                                                    "khalid.ham"};
   std::vector<std::string> finalTestRegexTrues = {
@@ -739,5 +1281,336 @@ int main() {
 
   test(finalTestRegex, finalTestRegexTrues, finalTestRegexFalses);
 
+  // ambiguous kleene, a backtracking search explores every way of splitting
+  // the input between both branches
+  std::string ambiguousKleene = "(a|a)*";
+  std::vector<std::string> ambiguousKleeneFalses = {"b",
+                                                    std::string(5000, 'a') +
+                                                        "b"};
+  std::vector<std::string> ambiguousKleeneTrues = {"", "a",
+                                                   std::string(5000, 'a')};
+
+  test(ambiguousKleene, ambiguousKleeneTrues, ambiguousKleeneFalses);
+
+  // both branches accept the same tails so their states have to merge
+  std::string equivalentBranches = "(a+(b*))|(c+(b*))";
+  std::vector<std::string> equivalentBranchesFalses = {"", "b", "ac", "abc"};
+  std::vector<std::string> equivalentBranchesTrues = {"a", "c", "abbb", "cbb"};
+
+  test(equivalentBranches, equivalentBranchesTrues, equivalentBranchesFalses);
+
+  // star binds tighter than concatenation, which binds tighter than
+  // alternation, and + is the same concatenation as juxtaposition
+  testParse("ab|c*", "alt(cat(a,b),star(c))");
+  testParse("a+b", "cat(a,b)");
+  testParse("a*+b", "cat(star(a),b)");
+  testParse("(a|b)(c)", "cat(group(alt(a,b),1),group(c,2))");
+  testParse("a**", "star(a)");
+  testParse("", "empty");
+  testParse("a|", "alt(a,empty)");
+  testParse("()", "group(empty,1)");
+  testParse("(a(b))*", "star(group(cat(a,group(b,2)),1))");
+  testParse("\\\\\\+\\*\\x41\\n\\.", "cat(\\,+,*,A,\\x0a,.)");
+  testParseError("(a");
+  testParseError("a)");
+  testParseError("*a");
+  testParseError("+a");
+  testParseError("a+");
+  testParseError("a++b");
+  testParseError("a\\");
+  testParseError("\\x4");
+  testParseError("\\q");
+  testParseError(std::string(2000, '(') + std::string(2000, ')'));
+
+  // classes are sorted ranges, a single byte is a literal
+  testParse("[a-c]x", "cat([a-c],x)");
+  testParse("[c-ea-b]", "[a-e]");
+  testParse("[^\\x00-`b-\\xff]", "a");
+  testParse("[]a-]", "[-]a]");
+  testParse("[\\d_]", "[0-9_]");
+  testParse("\\s", "[\\x09-\\x0d\\x20]");
+  testParse("\\D", "[\\x00-/:-\\xff]");
+  testParse(".", "[\\x00-\\x09\\x0b-\\xff]");
+  testParseError("[a");
+  testParseError("[]");
+  testParseError("[z-a]");
+  testParseError("[a-\\d]");
+
+  testParse("a{3}", "rep(a,3,3)");
+  testParse("a{2,}", "rep(a,2,)");
+  testParse("(ab){0,2}", "rep(group(cat(a,b),1),0,2)");
+  testParse("a{0,}", "star(a)");
+  testParse("a*{0,}", "star(a)");
+  testParse("a{1}", "a");
+  testParse("a{2}*", "star(rep(a,2,2))");
+  testParse("ab{2}", "cat(a,rep(b,2,2))");
+  testSimplify("ab|ac", true, "cat(a,[b-c])", "abc", 4);
+  testSimplify("abc|abd|ab|x", true, "alt(cat(a,b,alt([c-d],empty)),x)",
+               "abcdx", 4);
+  testSimplify("a|b|[c-e]|x*|f", true, "alt([a-e],star(x),f)", "abfx", 4);
+  testSimplify("((a*)*)*", false, "star(a)", "ab", 4);
+  testSimplify("((a*)*)*", true, "star(group(star(group(star(a),2)),1))",
+               "ab", 4);
+  testSimplify("(a(bc))d", false, "cat(a,b,c,d)", "abcd", 5);
+  testSimplify("a|(b|c)|a", false, "[a-c]", "abcd", 3);
+  testSimplify("ab|c|ab", true, "alt(cat(a,b),c)", "abc", 4);
+  testSimplify("x{0}y()z", false, "cat(y,z)", "xyz", 4);
+  testSimplify("abx|aby|b|abz", true, "alt(cat(a,b,[x-y]),b,cat(a,b,z))",
+               "abxyz", 4);
+  testSimplify("(ab|a)(c|bcd)|ax", false,
+               "cat(a,alt(cat(alt(b,empty),alt(c,cat(b,c,d))),x))",
+               "abcdx", 5);
+  testSimplify("a|ab|(a)b", false, "cat(a,alt(empty,b))", "ab", 4);
+  testParseError("{2}");
+  testParseError("a{");
+  testParseError("a{2");
+  testParseError("a{,3}");
+  testParseError("a{3,2}");
+  testParseError("a{1,x}");
+  testParseError("a{99999999}");
+  std::string deepRepeats = "a";
+  for (int i = 0; i < 2000; i++) {
+    deepRepeats += "{1,2}";
+  }
+  testParseError(deepRepeats);
+
+  // juxtaposed literals now match all of their characters
+  test("ab|cd", {"ab", "cd"}, {"", "a", "abcd", "ac"});
+  test("(a|b)*abb", {"abb", "aabb", "babb", "ababb"}, {"", "ab", "abba"});
+  test("a\\+b\\*", {"a+b*"}, {"ab", "a+b", "aab"});
+
+  // character classes are one edge per range, not one branch per byte
+  test("[a-z0-9_]*@[a-z][a-z]*\\.com", {"joe_42@mail.com", "@x.com"},
+       {"Joe@mail.com", "joe@.com", "joe@mailxcom", "joe@mail.com\n"});
+  test("[^abc]x.", {"dx!", "zxa", "\xffx\x01"}, {"ax!", "dx\n", "dx", "x"});
+  test("\\d\\d*-\\w*\\s\\S", {"12-ab_9 x", "1-\tZ"},
+       {"-a x", "1-a  ", "1-a-x", "a1- x"});
+  test("a[^\\x00-\\xff]|b", {"b"}, {"", "a", "ab"});
+
+  // small repeats are written out and get every engine
+  test("[0-9]{1,3}", {"7", "42", "999"}, {"", "1234", "4a"});
+  test("(ab){2,}c", {"ababc", "abababc"}, {"abc", "ababab", "c"});
+  test("a{2}b{0,2}", {"aa", "aab", "aabb"}, {"a", "aaa", "aabbb"});
+  test("x{0}y", {"y"}, {"xy", ""});
+
+  // a long generated pattern compiles in time linear in its size
+  std::string generated;
+  for (int i = 0; i < 5000; i++) {
+    generated += i % 2 == 0 ? "(ab|c)" : "d*";
+  }
+  std::unique_ptr<Regex> generatedRegex =
+      untraced([&] { return Regex::compile(generated); });
+  std::string generatedInput;
+  for (int i = 0; i < 2500; i++) {
+    generatedInput += i % 2 == 0 ? "ab" : "cddd";
+  }
+  assert(generatedRegex->isMatch(generatedInput));
+  assert(!generatedRegex->isMatch(generatedInput + "a"));
+
+  testMinimization(equivalentBranches, 3);
+  testMinimization(ambiguousKleene, 2);
+  testMinimization(quadAlternatorRegex, 3);
+
+  testByteClasses(singleA, 2);
+  testByteClasses(concatenationBinary, 3);
+  testByteClasses(quadAlternatorRegex, 5);
+  testByteClasses(finalTestRegex, 18);
+  testByteClasses("[a-z0-9]*x", 4);
+
+  testPrefilter(finalTestRegex, "khalid.hamd", ".com", "khalid.hamd");
+  testPrefilter(altConCombo3Regex, "a", "d", "a");
+  testPrefilter(simpleKleene, "", "", "");
+  testPrefilter("x+(a*)+y+z", "x", "yz", "yz");
+  testPrefilter("(ab){3}", "ababab", "ababab", "ababab");
+  testPrefilter("x(ab){2,3}", "xab", "ab", "xab");
+  testFindLiteral();
+
+  testSearch(simpleKleene, "baab", MatchKind::LeftmostFirst,
+             {{0, 0}, {1, 3}, {3, 3}, {4, 4}});
+  testSearch("a|(a+b)", "xab", MatchKind::LeftmostFirst, {{1, 2}});
+  testSearch("a*", "", MatchKind::LeftmostFirst, {{0, 0}});
+  testSearch("b*", "", MatchKind::LeftmostLongest, {{0, 0}});
+  testSearch("", "", MatchKind::LeftmostFirst, {{0, 0}});
+  testSearch("x(a|b)*", "", MatchKind::LeftmostFirst, {});
+  testSearch("a(|b)c*", "xab", MatchKind::LeftmostFirst, {{1, 2}});
+  testSearch("a|(a+b)", "xab", MatchKind::LeftmostLongest, {{1, 3}});
+  testSearch(concatKleeneCombo2Regex, "xcooc", MatchKind::LeftmostFirst,
+             {{1, 4}, {4, 5}});
+  testSearch(altKleeneCombo1, "ccox", MatchKind::LeftmostLongest,
+             {{0, 3}, {3, 3}, {4, 4}});
+  testSearch(altConCombo2Regex, "zzz", MatchKind::LeftmostFirst, {});
+  testSearch(altConCombo2Regex, "zabzc", MatchKind::LeftmostLongest,
+             {{1, 3}, {4, 5}});
+  testSearch("\\d\\d*", "ab12c345", MatchKind::LeftmostFirst,
+             {{2, 4}, {5, 8}});
+  testSearch(finalTestRegex,
+             "from khalid.hamdaan@gmail.com to khalid.hamdn@microsoft.com",
+             MatchKind::LeftmostFirst, {{5, 29}, {33, 59}});
+
+  testRegexSet({singleA, concatenationBinary, binaryAlternatorRegex,
+                simpleKleene, altKleeneCombo1, finalTestRegex},
+               {{"a", {0, 2, 3}},
+                {"ab", {1}},
+                {"b", {2}},
+                {"", {3, 4}},
+                {"aaaa", {3}},
+                {"coco", {4}},
+                {"c", {4}},
+                {"khalid.hamdaan@gmail.com", {5}},
+                {"khalid.hamdaan@yahoo.com", {}},
+                {"z", {}}});
+
+  // a few hundred rules still take a single scan per input
+  std::vector<std::string> manyRules;
+  for (int i = 0; i < 300; i++) {
+    std::string rule = "r+u+l+e";
+    for (char digit : std::to_string(i)) {
+      rule += "+" + std::string(1, digit);
+    }
+    manyRules.push_back(rule);
+  }
+  testRegexSet(manyRules,
+               {{"rule0", {0}}, {"rule42", {42}}, {"rule299", {299}},
+                {"rule300", {}}, {"rule", {}}});
+
+  std::string longCoco;
+  for (int i = 0; i < 5000; i++) {
+    longCoco += "co";
+  }
+  testParallel(altKleeneCombo1,
+               {longCoco, longCoco + "c", longCoco + "x", "x" + longCoco,
+                std::string(5000, 'c'), ""});
+  std::string longAs(10000, 'a');
+  testParallel(simpleKleene, {longAs, longAs + "b", "b" + longAs});
+
+  testMatchMany(finalTestRegex,
+                {"khalid.hamdaan@gmail.com", "khalid.hamdaan@yahoo.com",
+                 "khalid@gmail.com", "", "k", "khalid.hamdaan@gmail.comx"});
+  testJit(finalTestRegex, "k.@gmailcozx");
+  testJit("(a|c|e|g|i|k|m|o)*+z", "abcegikmoz");
+
+  // matched while compiling, a wrong table fails the build
+  static_assert(staticMatch<"a+(b|c)+d">("acd"));
+  static_assert(!staticMatch<"a+(b|c)+d">("ad"));
+  static_assert(staticMatch<"(c|o)*">("coocoo"));
+  static_assert(staticMatch<"">(""));
+  static_assert(!staticMatch<"">("a"));
+  static_assert(staticMatch<"ab|cd*">("cddd"));
+  static_assert(!staticMatch<"ab|cd*">("abd"));
+  static_assert(staticMatch<R"(a\+b\x2a)">("a+b*"));
+  static_assert(staticMatch<R"([a-f\d]*\.[^.]\s)">("c0ffee.x\t"));
+  static_assert(!staticMatch<R"([a-f\d]*\.[^.]\s)">("c0ffee.. "));
+
+  testStatic<"a+b">(concatenationBinaryTrues, concatenationBinaryFalses);
+  testStatic<"(a+b)+c">(concatenationTrues, concatenationFalses);
+  testStatic<"a|b|c|d">(quadAlternatorTrues, quadAlternatorFalses);
+  testStatic<"(a+b)|(c+d)">({"ab", "cd"}, altConCombo1Falses);
+  testStatic<"a+(b|c)+d">(altConCombo3Trues, altConCombo3Falses);
+  testStatic<"(c+d)*">(concatKleeneCombo1Trues, concatKleeneCombo1Falses);
+  testStatic<"c+(o)*">(concatKleeneCombo2Trues, concatKleeneCombo2Falses);
+  testStatic<"(c|o)*">(altKleeneCombo1Trues, altKleeneCombo1Falses);
+  testStatic<"d+(a*)+(n|o)+i">(allCombo2Trues, allCombo2Falses);
+  testStatic<"k+h+a+l+i+d+\\.+h+a+m+d+(a*)+n+@+((g+m+a+i+l)|(m+i+c+r+o+s+o+"
+             "f+t))+\\.+c+o+m">(finalTestRegexTrues, finalTestRegexFalses);
+  testStatic<"(a|a)*">(ambiguousKleeneTrues, ambiguousKleeneFalses);
+  testStatic<"(a+(b*))|(c+(b*))">(equivalentBranchesTrues,
+                                  equivalentBranchesFalses);
+  testStatic<"[^abc]x.">({"dx!", "zxa"}, {"ax!", "dx\n", "dx", "x"});
+  testStatic<"(ab){2,}c{0,2}">({"abab", "ababab", "ababcc"},
+                                {"ab", "ababccc", "abac"});
+  testStaticParser("(a|ab)(c|bcd)(d*)", "abcd", 6);
+  testStaticParser("[^a-c\\d]x.|\\x41\\+", "ab1xA+\n", 4);
+  testStaticParser("(ab){2,}c{0,2}|[0-9]{1,3}", "abc1", 7);
+  testStaticParser("(a*b|)*\\.|\\s\\S", "ab. \t", 5);
+  testStaticParser("[]a]*[a-]\\W", "]a-!", 5);
+  testStaticRejects("a{1001}");
+  testStaticRejects("(ab){2,5000}");
+  testStaticRejects("(a{1000}){1000}");
+  testStatic<"[0-9]{1,3}x{2}">({"1xx", "999xx"}, {"xx", "1234xx", "1x"});
+
+  testNthFromEnd(15);
+
+  testPlan("hello", Engine::Literal, Engine::Literal, Engine::Literal,
+           Engine::Literal, {"hello", "hell", "oh hello", "", "hello!"});
+  testPlan("(hel)(lo)", Engine::Literal, Engine::Literal, Engine::Literal,
+           Engine::OnePass, {"hello", "say hello"});
+  testPlan("(\\d\\d*)-(\\d\\d*)", Engine::Dfa, Engine::Dfa,
+           Engine::ReverseDfa, Engine::OnePass, {"1-2", "a 12-345 b", "1-"});
+  testPlan("(a|ab)(c|bcd)(d*)", Engine::Dfa, Engine::Dfa, Engine::ReverseDfa,
+           Engine::PikeVm, {"abcd", "xacdd", "ab"});
+  std::string window = std::string(1000, 'a') + "b" + std::string(13, 'a');
+  testPlan("(a|b)*a(a|b){13}", Engine::BitParallel, Engine::Nfa, Engine::Nfa,
+           Engine::PikeVm, {window, "b" + window, window + "a", "ab"});
+  testPlan("(a|b)*a(a|b){80}", Engine::LazyDfa, Engine::Nfa, Engine::Nfa,
+           Engine::PikeVm,
+           {"a" + std::string(80, 'b'), "ba" + std::string(79, 'a'), "ab"});
+  testLazyDfaPool();
+  testPlan("x[0-9]{1,100000}", Engine::Counters, Engine::Counters,
+           Engine::None, Engine::None, {});
+
+  testCounting("[0-9]{2,4}", "1a", 6);
+  testCounting("a{3}b{0,2}c{2,}", "abc", 8);
+  testCounting("(a|b){2}a{1,3}", "ab", 8);
+  testCounting("(a{2,3}b)*", "ab", 9);
+  testCounting("a*a{3,5}", "ab", 8);
+  testCounting("(a|ab){2,3}b{1,2}", "ab", 8);
+  testCounting("x[^y]{1,3}y|z{2}", "xyz", 7);
+  testCounting("a{0}b|a{1,}", "ab", 6);
+  testLargeRepeats();
+  testReverseSearch("a|(a+b)", "abx", 6);
+  testReverseSearch("(a|ab)(c|bcd)", "abcd", 6);
+  testReverseSearch("x*", "xy", 6);
+  testReverseSearch("(a*b|b)c*", "abc", 6);
+  testReverseSearch("[a-c]{1,3}b|c", "abc", 6);
+  testReverseSearch("(ab|a)*(b|)", "ab", 8);
+  testAhoCorasick("he|she|his|hers", "hers", 6);
+  testAhoCorasick("a|ab|abc|b|bc", "abc", 7);
+  testAhoCorasick("abc|(b|bc)|c|abc", "abcd", 6);
+  testAhoCorasick("xyz|yz|y|zx|wxy|vwxyz", "vwxyz", 5);
+  testKeywordList();
+  testStream("a|(a+b)", "abx", 6);
+  testStream("x*", "xy", 6);
+  testStream("(a*b|b)c*", "abc", 6);
+  testStream("(ab|a)*(b|)", "ab", 7);
+  testStream("abc|b", "abcx", 6);
+  testStream("he|she|his|hers", "hers", 6);
+  testStream("ab*c|a", "abc", 7);
+  testStreamLog("ERROR \\d\\d*|WARN");
+  testStreamLog("exceeded|quota|heartbeat");
+  std::string durations;
+  for (int i = 0; i < 40; i++) {
+    durations += (i == 0 ? "" : "|") + std::to_string(i * 97) + "ms";
+  }
+  testStreamLog(durations);
+  testCaptures("(\\d\\d*)-(\\d\\d*)", "tel 555-1234.", {{4, 12}, {4, 7}, {8, 12}});
+  testCaptures("(a|ab)(c|bcd)(d*)", "abcd", {{0, 4}, {0, 1}, {1, 4}, {4, 4}});
+  testCaptures("(a)|(b)", "xb", {{1, 2}, {std::string::npos, std::string::npos}, {1, 2}});
+  testCaptures("(a(b|))*", "ababa", {{0, 5}, {4, 5}, {5, 5}});
+  testCaptures("((a)|b)*", "ab", {{0, 2}, {1, 2}, {0, 1}});
+  testCaptures("([a-z][a-z]*)@([a-z][a-z]*)\\.com", "mail bob@example.com now",
+               {{5, 20}, {5, 8}, {9, 16}});
+  testCaptures("(x)", "abc", {});
+  testCaptureEngines("(\\d*)-(\\d*)", "1-", 6, true);
+  testCaptureEngines("(a*)(b|c)(a*)", "abc", 6, true);
+  testCaptureEngines("(a|ab)(c|bcd)(d*)", "abcd", 5, false);
+  testCaptureEngines("(a*)(a*)", "ab", 6, false);
+  testCaptureEngines("((a)|b)*c", "abc", 6, true);
+  testCaptureEngines("(a(b|))*", "ab", 7, true);
+  testCaptureEngines("(a|b)*(b)(a|b)", "ab", 6, false);
+  testCaptureEngines("x(y{2,3}|)z", "xyz", 6, true);
+
+  testRegexCache();
+
+  std::string nthFromEnd = "((a|b)*)+a";
+  for (int i = 1; i < 15; i++) {
+    nthFromEnd += "+(a|b)";
+  }
+  testAutomatonFile({finalTestRegex, altKleeneCombo1, "a|(a+b)", nthFromEnd,
+                     ""},
+                    {"", "a", "ab", "xab", "coco", "cox", "abaaaaaaaaaaaaaa",
+                     "khalid.hamdaan@gmail.com", "x khalid.hamdn@gmail.com"});
+
+  testMatchMany(altKleeneCombo1, {"", "c", "coco", "cocx", longCoco, "x"});
+
   return 0;
 }
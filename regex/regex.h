@@ -0,0 +1,5523 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define REGEX_JIT 1
+#include <sys/mman.h>
+#endif
+
+/*
+ * Primitives:
+ * - Every byte that is not an operator is a literal, operators become
+ *   literals when escaped with a backslash
+ *
+ * Concatenation:
+ * - juxtaposition, or "+" between the operands
+ *
+ * Alternation:
+ * - "|"
+ *
+ * Kleene Star:
+ * - "*"
+ *
+ * Grouping & Paranthesis:
+ * - "( )"
+ *
+ * Star binds tighter than concatenation, concatenation tighter than
+ * alternation.
+ * */
+
+/*
+ * Epsilon NFA Explanation Copy Pasta:
+ *
+ *An ε-NFA (epsilon-Nondeterministic Finite Automaton) is a type of finite
+automaton used in theoretical computer science and formal language theory to
+describe and recognize regular languages. It is an extension of a traditional
+NFA (Nondeterministic Finite Automaton) with the addition of epsilon transitions
+(also known as ε-transitions or lambda transitions).
+
+Let's break down the components and concepts of an ε-NFA in absolute detail:
+
+States: An ε-NFA consists of a finite set of states, often denoted by Q. Each
+state represents a specific condition or configuration of the automaton.
+
+Alphabet: There is a finite input alphabet Σ, which consists of symbols or
+characters that the automaton reads from an input string. These symbols are the
+basic building blocks of the language.
+
+Transitions: Unlike a traditional DFA (Deterministic Finite Automaton), an ε-NFA
+can have multiple transitions for a given state and input symbol. These
+transitions are non-deterministic, meaning that the automaton can move to
+multiple states at once when processing a particular symbol. Additionally,
+ε-NFAs can have epsilon transitions (ε-transitions), which are transitions that
+occur without consuming any input symbol. An ε-transition allows the automaton
+to move from one state to another without reading any input, effectively adding
+an extra dimension to its computation.
+
+Start State: There is a designated start state (often denoted as q0) where the
+automaton begins its computation.
+
+Accept States: The ε-NFA also has a set of accept states (or final states),
+which are states that, when reached after processing the entire input string,
+indicate that the automaton recognizes the input string as a valid member of the
+language.
+
+Epsilon Transitions: Epsilon transitions (ε-transitions) are transitions that
+are not associated with any input symbol. They are represented using the ε
+symbol. When the automaton encounters an ε-transition, it can move from the
+current state to the target state without consuming any input symbol. Epsilon
+transitions allow for non-determinism, as the automaton can make choices without
+needing any input cues.
+
+Language Recognition: To determine whether a given input string belongs to the
+language recognized by the ε-NFA, the automaton explores all possible paths
+through its states, considering both regular transitions (based on input
+symbols) and ε-transitions. It accepts the input string if there exists at least
+one path that leads to an accept state after processing the entire input.
+
+Equivalence to Regular Languages: ε-NFAs are capable of recognizing the same
+class of languages as DFAs and NFAs. This means that any language recognized by
+an ε-NFA can also be recognized by a regular NFA or DFA. Similarly, any language
+recognized by a regular NFA or DFA can be recognized by an ε-NFA.
+ * */
+
+/*
+ * Sparse set (Briggs & Torczon) over the integers [0, capacity). Insert,
+ * membership and clear are all O(1) and iteration walks the members in the
+ * order they were inserted, which is exactly what the NFA simulation needs for
+ * the set of states that are active after each character.
+ */
+class SparseSet {
+private:
+  std::vector<int> dense;
+  std::vector<int> sparse;
+  int count = 0;
+
+public:
+  explicit SparseSet(int capacity) : dense(capacity), sparse(capacity) {}
+
+  bool contains(int value) const {
+    int idx = this->sparse[value];
+    return idx < this->count && this->dense[idx] == value;
+  }
+
+  // returns false when the value was already a member
+  bool insert(int value) {
+    if (this->contains(value)) {
+      return false;
+    }
+    this->dense[this->count] = value;
+    this->sparse[value] = this->count;
+    this->count++;
+    return true;
+  }
+
+  void clear() { this->count = 0; }
+
+  // keeps only the first size members
+  void truncate(int size) { this->count = std::min(this->count, size); }
+
+  int size() const { return this->count; }
+
+  // members in insertion order, iterating by index is safe while inserting
+  int operator[](int index) const { return this->dense[index]; }
+
+  bool empty() const { return this->count == 0; }
+
+  std::vector<int>::const_iterator begin() const {
+    return this->dense.begin();
+  }
+
+  std::vector<int>::const_iterator end() const {
+    return this->dense.begin() + this->count;
+  }
+};
+
+// the bytes from to to, both included
+struct ByteRange {
+  unsigned char from = 0;
+  unsigned char to = 0;
+
+  bool contains(unsigned char byte) const {
+    return byte >= this->from && byte <= this->to;
+  }
+
+  bool operator==(const ByteRange &other) const {
+    return this->from == other.from && this->to == other.to;
+  }
+
+  bool operator<(const ByteRange &other) const {
+    return this->from != other.from ? this->from < other.from
+                                    : this->to < other.to;
+  }
+};
+
+/*
+ * Partition of the 256 byte values into classes of bytes that the pattern
+ * never tells apart. Starting from a single class, every label that appears on
+ * a transition splits each class into the bytes inside and outside of it.
+ * Automata then only need one column per class instead of one per byte, a
+ * pattern over a handful of letters needs a handful of columns.
+ */
+class ByteClasses {
+private:
+  std::array<unsigned char, 256> classes;
+  // lowest byte of every class, used to ask the NFA where a class leads
+  std::array<unsigned char, 256> representatives;
+  int classCount = 1;
+
+public:
+  ByteClasses() {
+    this->classes.fill(0);
+    this->representatives.fill(0);
+  }
+
+  // separates the bytes in [from, to] from every byte outside of that range
+  void split(unsigned char from, unsigned char to) {
+    std::vector<int> renumbered(this->classCount * 2, -1);
+    int count = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      int key = this->classes[byte] * 2 + (byte >= from && byte <= to);
+      if (renumbered[key] == -1) {
+        renumbered[key] = count;
+        this->representatives[count] = byte;
+        count++;
+      }
+      this->classes[byte] = renumbered[key];
+    }
+    this->classCount = count;
+  }
+
+  int get(unsigned char byte) const { return this->classes[byte]; }
+
+  unsigned char getRepresentative(int byteClass) const {
+    return this->representatives[byteClass];
+  }
+
+  int size() const { return this->classCount; }
+
+  // pointer to the 256 entry map for matching loops
+  const unsigned char *data() const { return this->classes.data(); }
+
+  void print() const {
+    std::cout << "Byte Classes: " << this->classCount << std::endl;
+    for (int byteClass = 0; byteClass < this->classCount; byteClass++) {
+      std::cout << "+ " << byteClass << " -> [ ";
+      int byte = 0;
+      while (byte < 256) {
+        if (this->classes[byte] != byteClass) {
+          byte++;
+          continue;
+        }
+        int runEnd = byte;
+        while (runEnd + 1 < 256 && this->classes[runEnd + 1] == byteClass) {
+          runEnd++;
+        }
+        if (runEnd == byte) {
+          std::cout << byte << ", ";
+        } else {
+          std::cout << byte << "-" << runEnd << ", ";
+        }
+        byte = runEnd + 1;
+      }
+      std::cout << " ] \n";
+    }
+  }
+};
+
+/*
+ * Finds the first occurrence of needle in [haystack, haystack + size), nullptr
+ * if there is none. With SSE2 sixteen candidate positions are tested at once
+ * by comparing the first and the last byte of the needle against two shifted
+ * loads, only positions where both agree are verified with memcmp. Without it
+ * the vectorized memchr of the C library finds candidates for the first byte.
+ */
+inline const char *findLiteral(const char *haystack, size_t size,
+                               std::string_view needle) {
+  size_t length = needle.size();
+  if (length == 0) {
+    return haystack;
+  }
+  if (length > size) {
+    return nullptr;
+  }
+  if (length == 1) {
+    return static_cast<const char *>(std::memchr(haystack, needle[0], size));
+  }
+
+  size_t i = 0;
+  size_t lastStart = size - length;
+
+#if defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[length - 1]);
+  for (; i + 16 <= lastStart + 1; i += 16) {
+    __m128i blockFirst =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+    __m128i blockLast = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(haystack + i + length - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+    while (mask != 0) {
+      int offset = __builtin_ctz(mask);
+      if (std::memcmp(haystack + i + offset + 1, needle.data() + 1,
+                      length - 2) == 0) {
+        return haystack + i + offset;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  while (i <= lastStart) {
+    const char *candidate = static_cast<const char *>(
+        std::memchr(haystack + i, needle[0], lastStart - i + 1));
+    if (candidate == nullptr) {
+      return nullptr;
+    }
+    if (std::memcmp(candidate + 1, needle.data() + 1, length - 1) == 0) {
+      return candidate;
+    }
+    i = candidate - haystack + 1;
+  }
+
+  return nullptr;
+}
+
+// where needle first occurs in input at or after from, npos if it does not.
+// An empty needle is found at from, also in a view without data, for which
+// the pointer version returns nullptr
+inline size_t findLiteralFrom(std::string_view input, size_t from,
+                              std::string_view needle) {
+  if (needle.empty()) {
+    return from;
+  }
+  const char *found =
+      findLiteral(input.data() + from, input.size() - from, needle);
+  return found == nullptr ? std::string_view::npos : found - input.data();
+}
+
+/*
+ * Finds the first byte in [haystack, haystack + size) that is one of bytes,
+ * nullptr if there is none. Meant for a handful of bytes: with SSE2 sixteen
+ * positions are compared against every one of them at once, a single byte is
+ * left to memchr.
+ */
+inline const char *findAnyByte(const char *haystack, size_t size,
+                               std::string_view bytes) {
+  if (bytes.size() == 1) {
+    return static_cast<const char *>(std::memchr(haystack, bytes[0], size));
+  }
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  __m128i needles[4];
+  size_t needleCount = std::min<size_t>(bytes.size(), 4);
+  for (size_t j = 0; j < needleCount; j++) {
+    needles[j] = _mm_set1_epi8(bytes[j]);
+  }
+  if (needleCount == bytes.size()) {
+    for (; i + 16 <= size; i += 16) {
+      __m128i block =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+      __m128i found = _mm_cmpeq_epi8(block, needles[0]);
+      for (size_t j = 1; j < needleCount; j++) {
+        found = _mm_or_si128(found, _mm_cmpeq_epi8(block, needles[j]));
+      }
+      unsigned mask = _mm_movemask_epi8(found);
+      if (mask != 0) {
+        return haystack + i + __builtin_ctz(mask);
+      }
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (bytes.find(haystack[i]) != std::string_view::npos) {
+      return haystack + i;
+    }
+  }
+  return nullptr;
+}
+
+// compilation prints every intermediate automaton while this is set
+inline bool traceCompilation = false;
+
+/*
+ * How a search picks between several matches starting at the same position.
+ * LeftmostFirst prefers the match a backtracking engine would find first:
+ * the left branch of an alternation, and as many iterations of a kleene star
+ * as possible. LeftmostLongest always takes the longest one.
+ */
+enum class MatchKind { LeftmostFirst, LeftmostLongest };
+
+// a match covers the bytes in [start, end)
+struct Match {
+  size_t start = 0;
+  size_t end = 0;
+
+  bool operator==(const Match &other) const {
+    return this->start == other.start && this->end == other.end;
+  }
+};
+
+class Nfa {
+private:
+  // final state -> id of the pattern it accepts, always 0 unless several
+  // patterns were combined into one automaton
+  std::unordered_map<int, int> finalStates;
+  // epsilon edges are kept in the order they were added, when a search has to
+  // pick between several paths the edge added first wins
+  std::unordered_map<int, std::vector<int>> epsilonTransitions;
+  // every edge consumes one byte out of a range, a character class is a
+  // handful of edges instead of an alternation over all of its bytes
+  std::unordered_map<int, std::vector<std::pair<ByteRange, int>>> transitions;
+
+  int stateCounter = 0;
+  int patternCount = 1;
+
+  /*
+   * Frozen representation used for matching. Once the topology is final the
+   * maps above are flattened into contiguous arrays and released: state s
+   * owns the edges in [edgeOffsets[s], edgeOffsets[s + 1]) of edgeRanges and
+   * edgeTargets, and the same layout is used for epsilon edges and closures.
+   * Matching then never hashes or allocates.
+   */
+  bool frozen = false;
+  // pattern accepted by every state, -1 for states that are not final
+  std::vector<int> finalPatterns;
+  std::vector<int> edgeOffsets;
+  std::vector<ByteRange> edgeRanges;
+  std::vector<int> edgeTargets;
+  std::vector<int> epsilonOffsets;
+  std::vector<int> epsilonTargets;
+  // epsilon closure of every state the simulation can enter (the start state
+  // and every target of a symbol transition), empty for all other states.
+  // Only states that either have symbol transitions or are final are kept in
+  // a closure since those are the only ones that matter once the closure has
+  // been taken.
+  std::vector<int> closureOffsets;
+  std::vector<int> closureStates;
+  ByteClasses byteClasses;
+
+  bool isFinalState(int state) const {
+    if (this->frozen) {
+      return this->finalPatterns[state] != -1;
+    }
+    return this->finalStates.find(state) != this->finalStates.end();
+  }
+
+  void assertMutable() const {
+    if (this->frozen) {
+      throw std::logic_error("Nfa is frozen and can no longer be modified");
+    }
+  }
+
+  void assertFrozen() const {
+    if (!this->frozen) {
+      throw std::logic_error("Nfa has to be frozen before matching");
+    }
+  }
+
+  // Depth first so a closure lists its states in priority order: everything
+  // reachable over an earlier epsilon edge comes before anything reachable
+  // over a later one.
+  void appendEpsilonClosure(int state, SparseSet &visited,
+                            std::vector<int> &stack) {
+    visited.clear();
+    stack.clear();
+    stack.push_back(state);
+
+    while (!stack.empty()) {
+      int current = stack[stack.size() - 1];
+      stack.pop_back();
+      if (!visited.insert(current)) {
+        continue;
+      }
+
+      if (this->finalPatterns[current] != -1 ||
+          this->edgeOffsets[current] != this->edgeOffsets[current + 1]) {
+        this->closureStates.push_back(current);
+      }
+
+      for (int i = this->epsilonOffsets[current + 1] - 1;
+           i >= this->epsilonOffsets[current]; i--) {
+        int nextState = this->epsilonTargets[i];
+        if (!visited.contains(nextState)) {
+          stack.push_back(nextState);
+        }
+      }
+    }
+  }
+
+public:
+  const int startState =
+      0; // Based on how states are create 0 is always the init state
+  const int endAcceptanceState =
+      1; // Based on how states are created 1 is always the accepting state
+
+  static std::unique_ptr<Nfa> createEpsilonNfa() {
+    std::unique_ptr<Nfa> base = std::make_unique<Nfa>();
+    // the order in which function arguments are evaluated is unspecified, so
+    // the states have to be created before wiring them up
+    int start = base->createNewState();
+    int end = base->createNewState();
+    base->addEpsilonTransition(start, end);
+
+    base->addFinalState(base->endAcceptanceState);
+
+    return base;
+  }
+
+  Nfa() {}
+
+  /*
+   * Combines frozen automata into one whose start state forks into the start
+   * state of each of them, the final states of nfas[i] accept pattern i. The
+   * result is frozen as well. State 1 is left without any transitions so the
+   * start state still comes first, it just never accepts anything.
+   */
+  static std::unique_ptr<Nfa>
+  createUnion(const std::vector<const Nfa *> &nfas) {
+    std::unique_ptr<Nfa> combined = std::make_unique<Nfa>();
+    combined->createNewState();
+    combined->createNewState();
+
+    for (size_t patternId = 0; patternId < nfas.size(); patternId++) {
+      const Nfa *nfa = nfas[patternId];
+      nfa->assertFrozen();
+
+      int offset = combined->stateCounter;
+      for (int state = 0; state < nfa->stateCounter; state++) {
+        combined->createNewState();
+      }
+
+      combined->addEpsilonTransition(combined->startState,
+                                     offset + nfa->startState);
+      for (int state = 0; state < nfa->stateCounter; state++) {
+        for (int i = nfa->edgeOffsets[state]; i < nfa->edgeOffsets[state + 1];
+             i++) {
+          combined->addRangeTransition(offset + state, nfa->edgeRanges[i],
+                                       offset + nfa->edgeTargets[i]);
+        }
+        for (int i = nfa->epsilonOffsets[state];
+             i < nfa->epsilonOffsets[state + 1]; i++) {
+          combined->addEpsilonTransition(offset + state,
+                                         offset + nfa->epsilonTargets[i]);
+        }
+        if (nfa->finalPatterns[state] != -1) {
+          combined->addFinalState(offset + state, patternId);
+        }
+      }
+    }
+
+    combined->freeze();
+    return combined;
+  }
+
+  int createNewState() {
+    this->assertMutable();
+    this->stateCounter++;
+    return this->stateCounter - 1;
+  }
+
+  void addTransition(int fromState, const std::string &symbol, int toState) {
+    unsigned char byte = static_cast<unsigned char>(symbol[0]);
+    this->addRangeTransition(fromState, ByteRange{byte, byte}, toState);
+  }
+
+  // an edge taken on any byte of range
+  void addRangeTransition(int fromState, ByteRange range, int toState) {
+    this->assertMutable();
+    this->transitions[fromState].push_back(std::make_pair(range, toState));
+  }
+
+  void addEpsilonTransition(int fromState, int toState) {
+    this->assertMutable();
+    std::vector<int> &epsilons = this->epsilonTransitions[fromState];
+    if (std::find(epsilons.begin(), epsilons.end(), toState) ==
+        epsilons.end()) {
+      epsilons.push_back(toState);
+    }
+  }
+
+  bool hasEpsilonTransitions(int state) {
+    std::unordered_map<int, std::vector<int>>::iterator found =
+        this->epsilonTransitions.find(state);
+    if (found == this->epsilonTransitions.end()) {
+      return false;
+    }
+
+    return !this->epsilonTransitions[state].empty();
+  }
+
+  void transferEpsilonTransitions(int owner, int transferTo) {
+    this->assertMutable();
+    std::unordered_map<int, std::vector<int>>::iterator found =
+        this->epsilonTransitions.find(owner);
+    if (found == this->epsilonTransitions.end()) {
+      if (traceCompilation) {
+        std::cout << "nothing transfered" << std::endl;
+      }
+      return;
+    }
+    std::vector<int> epsilons = this->epsilonTransitions[owner];
+    this->epsilonTransitions[transferTo] = epsilons;
+    this->epsilonTransitions[owner] = std::vector<int>();
+  }
+
+  void removeEpsilonTransition(int fromState, int toState) {
+    this->assertMutable();
+    std::unordered_map<int, std::vector<int>>::iterator found =
+        this->epsilonTransitions.find(fromState);
+    if (found == this->epsilonTransitions.end()) {
+      return;
+    }
+
+    std::vector<int> &epsilons = found->second;
+    epsilons.erase(std::remove(epsilons.begin(), epsilons.end(), toState),
+                   epsilons.end());
+  }
+
+  void addFinalState(int state, int patternId = 0) {
+    this->assertMutable();
+    finalStates[state] = patternId;
+    this->patternCount = std::max(this->patternCount, patternId + 1);
+  }
+
+  /*
+   * Flattens the construction maps into the arrays used for matching and
+   * precomputes the epsilon closures. Closures only depend on the topology so
+   * from here on the NFA can no longer be modified.
+   */
+  void freeze() {
+    if (this->frozen) {
+      return;
+    }
+
+    int stateCount = this->stateCounter;
+
+    this->finalPatterns.assign(stateCount, -1);
+    for (const std::pair<const int, int> &finalState : this->finalStates) {
+      this->finalPatterns[finalState.first] = finalState.second;
+    }
+
+    this->edgeOffsets.assign(stateCount + 1, 0);
+    this->epsilonOffsets.assign(stateCount + 1, 0);
+    for (int state = 0; state < stateCount; state++) {
+      this->edgeOffsets[state] = this->edgeTargets.size();
+      std::unordered_map<int, std::vector<std::pair<ByteRange, int>>>::iterator
+          foundTransitionAbleState = this->transitions.find(state);
+      if (foundTransitionAbleState != this->transitions.end()) {
+        // edges keep the order they were added in, like epsilon edges, an
+        // earlier alternative has priority over a later one
+        std::set<std::pair<ByteRange, int>> seen;
+        for (const std::pair<ByteRange, int> &edge :
+             foundTransitionAbleState->second) {
+          if (seen.insert(edge).second) {
+            this->edgeRanges.push_back(edge.first);
+            this->edgeTargets.push_back(edge.second);
+          }
+        }
+      }
+
+      this->epsilonOffsets[state] = this->epsilonTargets.size();
+      std::unordered_map<int, std::vector<int>>::const_iterator found =
+          this->epsilonTransitions.find(state);
+      if (found != this->epsilonTransitions.end()) {
+        this->epsilonTargets.insert(this->epsilonTargets.end(),
+                                    found->second.begin(), found->second.end());
+      }
+    }
+    this->edgeOffsets[stateCount] = this->edgeTargets.size();
+    this->epsilonOffsets[stateCount] = this->epsilonTargets.size();
+
+    std::vector<ByteRange> ranges = this->edgeRanges;
+    std::sort(ranges.begin(), ranges.end());
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+    for (const ByteRange &range : ranges) {
+      this->byteClasses.split(range.from, range.to);
+    }
+
+    std::vector<char> entered(stateCount, false);
+    entered[this->startState] = true;
+    for (int toState : this->edgeTargets) {
+      entered[toState] = true;
+    }
+
+    SparseSet visited(stateCount);
+    std::vector<int> stack;
+    this->closureOffsets.assign(stateCount + 1, 0);
+    for (int state = 0; state < stateCount; state++) {
+      this->closureOffsets[state] = this->closureStates.size();
+      if (entered[state]) {
+        this->appendEpsilonClosure(state, visited, stack);
+      }
+    }
+    this->closureOffsets[stateCount] = this->closureStates.size();
+
+    // swapping with empty containers actually gives the memory back
+    std::unordered_map<int, std::vector<int>>().swap(this->epsilonTransitions);
+    std::unordered_map<int, std::vector<std::pair<ByteRange, int>>>().swap(
+        this->transitions);
+
+    this->frozen = true;
+  }
+
+  bool isFrozen() const { return this->frozen; }
+
+  bool isAccepting(int state) const { return this->isFinalState(state); }
+
+  /*
+   * The automaton of the reversed pattern: every edge turned around, the
+   * start state leading to all final states, and the old start state the
+   * only final one. States 0 and 1 swap places so the start state is still
+   * state 0. The result is frozen.
+   */
+  static std::unique_ptr<Nfa> reverse(const Nfa &nfa) {
+    nfa.assertFrozen();
+    std::unique_ptr<Nfa> reversed = std::make_unique<Nfa>();
+    for (int state = 0; state < nfa.stateCounter; state++) {
+      reversed->createNewState();
+    }
+
+    auto swapped = [](int state) { return state <= 1 ? 1 - state : state; };
+    for (int state = 0; state < nfa.stateCounter; state++) {
+      for (int i = nfa.edgeOffsets[state]; i < nfa.edgeOffsets[state + 1];
+           i++) {
+        reversed->addRangeTransition(swapped(nfa.edgeTargets[i]),
+                                     nfa.edgeRanges[i], swapped(state));
+      }
+      for (int i = nfa.epsilonOffsets[state];
+           i < nfa.epsilonOffsets[state + 1]; i++) {
+        reversed->addEpsilonTransition(swapped(nfa.epsilonTargets[i]),
+                                       swapped(state));
+      }
+      if (nfa.finalPatterns[state] != -1 &&
+          swapped(state) != reversed->startState) {
+        reversed->addEpsilonTransition(reversed->startState, swapped(state));
+      }
+    }
+    reversed->addFinalState(reversed->endAcceptanceState);
+
+    reversed->freeze();
+    return reversed;
+  }
+
+  const ByteClasses &getByteClasses() const {
+    this->assertFrozen();
+    return this->byteClasses;
+  }
+
+  int getStateCount() const { return this->stateCounter; }
+
+  // bytes held by the frozen arrays
+  size_t getMemoryUsed() const {
+    this->assertFrozen();
+    return sizeof(Nfa) +
+           sizeof(int) *
+               (this->finalPatterns.size() + this->edgeOffsets.size() +
+                this->edgeTargets.size() + this->epsilonOffsets.size() +
+                this->epsilonTargets.size() + this->closureOffsets.size() +
+                this->closureStates.size()) +
+           sizeof(ByteRange) * this->edgeRanges.size();
+  }
+
+  // adds every state reachable from the start state without consuming input
+  void addStartClosure(SparseSet &states) const {
+    this->assertFrozen();
+    for (int i = this->closureOffsets[this->startState];
+         i < this->closureOffsets[this->startState + 1]; i++) {
+      states.insert(this->closureStates[i]);
+    }
+  }
+
+  /*
+   * Moves every state in from over the symbol c and adds the epsilon closure
+   * of each state reached into to. entered is scratch space with the same
+   * capacity, it remembers which targets already had their closure added so
+   * no closure is walked twice for the same character.
+   */
+  void step(const SparseSet &from, char c, SparseSet &to,
+            SparseSet &entered) const {
+    this->assertFrozen();
+
+    to.clear();
+    entered.clear();
+    unsigned char symbol = static_cast<unsigned char>(c);
+
+    for (int state : from) {
+      for (int i = this->edgeOffsets[state]; i < this->edgeOffsets[state + 1];
+           i++) {
+        if (!this->edgeRanges[i].contains(symbol)) {
+          continue;
+        }
+
+        int toState = this->edgeTargets[i];
+        if (!entered.insert(toState)) {
+          continue;
+        }
+        for (int j = this->closureOffsets[toState];
+             j < this->closureOffsets[toState + 1]; j++) {
+          to.insert(this->closureStates[j]);
+        }
+      }
+    }
+  }
+
+  bool containsFinalState(const SparseSet &states) const {
+    for (int state : states) {
+      if (this->isFinalState(state)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int getPatternCount() const { return this->patternCount; }
+
+  // ids of the patterns accepted by any of states, sorted and without
+  // duplicates
+  std::vector<int> getMatchedPatterns(const SparseSet &states) const {
+    this->assertFrozen();
+    std::vector<int> patterns;
+    for (int state : states) {
+      if (this->finalPatterns[state] != -1) {
+        patterns.push_back(this->finalPatterns[state]);
+      }
+    }
+    std::sort(patterns.begin(), patterns.end());
+    patterns.erase(std::unique(patterns.begin(), patterns.end()),
+                   patterns.end());
+    return patterns;
+  }
+
+  /*
+   * Thompson simulation: instead of exploring one path at a time we keep the
+   * set of every state the automaton could be in after consuming each
+   * character and advance all of them together. A state is only ever added
+   * once per character so the run is bounded by input length times the number
+   * of states, no matter how ambiguous the expression is.
+   */
+  bool runSimulation(std::string_view input) const {
+    SparseSet current(this->stateCounter);
+    SparseSet next(this->stateCounter);
+    SparseSet entered(this->stateCounter);
+
+    this->addStartClosure(current);
+
+    for (char c : input) {
+      if (current.empty()) {
+        return false;
+      }
+      this->step(current, c, next, entered);
+      std::swap(current, next);
+    }
+
+    return this->containsFinalState(current);
+  }
+
+  // the bytes a match can start with, empty when there are more than limit
+  // of them or the empty string matches
+  std::string getStartBytes(size_t limit) const {
+    this->assertFrozen();
+    std::string bytes;
+    std::vector<char> seen(256, false);
+    for (int i = this->closureOffsets[this->startState];
+         i < this->closureOffsets[this->startState + 1]; i++) {
+      int state = this->closureStates[i];
+      if (this->finalPatterns[state] != -1) {
+        return std::string();
+      }
+      for (int j = this->edgeOffsets[state]; j < this->edgeOffsets[state + 1];
+           j++) {
+        for (int byte = this->edgeRanges[j].from;
+             byte <= this->edgeRanges[j].to; byte++) {
+          if (seen[byte]) {
+            continue;
+          }
+          seen[byte] = true;
+          bytes += static_cast<char>(byte);
+          if (bytes.size() > limit) {
+            return std::string();
+          }
+        }
+      }
+    }
+    return bytes;
+  }
+
+  // starts a thread at position in every state of the start closure that no
+  // thread holds yet, behind the existing ones
+  void startThreads(SparseSet &threads, std::vector<size_t> &starts,
+                    size_t position) const {
+    for (int i = this->closureOffsets[this->startState];
+         i < this->closureOffsets[this->startState + 1]; i++) {
+      if (threads.insert(this->closureStates[i])) {
+        starts[this->closureStates[i]] = position;
+      }
+    }
+  }
+
+  /*
+   * Records the match of the first thread in a final state at position, or
+   * for LeftmostLongest the one that started first and ends last, in match
+   * and drops the threads it makes pointless. matched tells whether match
+   * already holds a match from an earlier position, the result whether it
+   * holds one now.
+   */
+  bool acceptThreads(SparseSet &threads, const std::vector<size_t> &starts,
+                     size_t position, MatchKind kind, bool matched,
+                     Match &match) const {
+    int kept = 0;
+    for (int state : threads) {
+      kept++;
+      if (this->finalPatterns[state] == -1) {
+        continue;
+      }
+
+      size_t start = starts[state];
+      if (kind == MatchKind::LeftmostFirst) {
+        match.start = start;
+        match.end = position;
+        matched = true;
+        break;
+      }
+      if (!matched || start < match.start ||
+          (start == match.start && position > match.end)) {
+        match.start = start;
+        match.end = position;
+        matched = true;
+      }
+    }
+
+    if (matched && kind == MatchKind::LeftmostLongest) {
+      // threads are ordered by start, drop the ones that started later
+      kept = 0;
+      for (int state : threads) {
+        if (starts[state] > match.start) {
+          break;
+        }
+        kept++;
+      }
+    }
+    threads.truncate(kept);
+    return matched;
+  }
+
+  // moves every thread of from over symbol into to, in the same order and
+  // remembering where each one started
+  void stepThreads(const SparseSet &from, const std::vector<size_t> &fromStarts,
+                   unsigned char symbol, SparseSet &to,
+                   std::vector<size_t> &toStarts) const {
+    to.clear();
+    for (int state : from) {
+      for (int i = this->edgeOffsets[state]; i < this->edgeOffsets[state + 1];
+           i++) {
+        if (!this->edgeRanges[i].contains(symbol)) {
+          continue;
+        }
+        int toState = this->edgeTargets[i];
+        for (int j = this->closureOffsets[toState];
+             j < this->closureOffsets[toState + 1]; j++) {
+          if (to.insert(this->closureStates[j])) {
+            toStarts[this->closureStates[j]] = fromStarts[state];
+          }
+        }
+      }
+    }
+  }
+
+  /*
+   * Finds the leftmost match in input that starts at or after from. This is
+   * the Thompson simulation with every thread remembering where its match
+   * started. Threads are kept in priority order: a new thread is started at
+   * every position until something matched and goes behind the existing ones,
+   * and epsilon closures list their states in priority order, so the first
+   * thread to reach a state is the one that should own it. Once a thread
+   * matches, every thread behind it can be dropped for LeftmostFirst, and
+   * every thread that started later for LeftmostLongest.
+   *
+   * Every match has to start with prefix, positions where it does not occur
+   * are skipped without running any threads.
+   */
+  bool search(std::string_view input, size_t from, MatchKind kind,
+              Match &match,
+              std::string_view prefix = std::string_view()) const {
+    this->assertFrozen();
+
+    SparseSet current(this->stateCounter);
+    SparseSet next(this->stateCounter);
+    std::vector<size_t> currentStarts(this->stateCounter);
+    std::vector<size_t> nextStarts(this->stateCounter);
+    bool matched = false;
+
+    for (size_t position = from; position <= input.size(); position++) {
+      if (!matched) {
+        if (current.empty() && !prefix.empty()) {
+          const char *candidate = findLiteral(
+              input.data() + position, input.size() - position, prefix);
+          if (candidate == nullptr) {
+            return false;
+          }
+          position = candidate - input.data();
+        }
+        this->startThreads(current, currentStarts, position);
+      }
+
+      matched = this->acceptThreads(current, currentStarts, position, kind,
+                                    matched, match);
+      if (position == input.size() || (matched && current.empty())) {
+        break;
+      }
+
+      this->stepThreads(current, currentStarts,
+                        static_cast<unsigned char>(input[position]), next,
+                        nextStarts);
+      std::swap(current, next);
+      std::swap(currentStarts, nextStarts);
+    }
+
+    return matched;
+  }
+
+  static void printRange(const ByteRange &range) {
+    std::cout << range.from;
+    if (range.to != range.from) {
+      std::cout << "-" << range.to;
+    }
+  }
+
+  void print() const {
+    std::cout << "NFA { \n";
+
+    std::cout << "Final States: \n";
+
+    for (const std::pair<const int, int> &finalState : this->finalStates) {
+      std::cout << "+ " << finalState.first << std::endl;
+    }
+
+    if (this->frozen) {
+      this->printFrozen();
+      return;
+    }
+
+    std::cout << "EpsilonTransitions \n";
+
+    for (const std::pair<const int, std::vector<int>> &epsilonTransition :
+         this->epsilonTransitions) {
+      std::cout << "+ " << epsilonTransition.first << " -> [ ";
+      for (const int &state : epsilonTransition.second) {
+        std::cout << state << ", ";
+      }
+      std::cout << " ] \n";
+    }
+
+    std::cout << "Transitions \n";
+
+    for (const std::pair<const int, std::vector<std::pair<ByteRange, int>>>
+             &transition : this->transitions) {
+      std::cout << "+ From " << transition.first << std::endl;
+      for (const std::pair<ByteRange, int> &edge : transition.second) {
+        std::cout << "\tGiven Symbol ";
+        printRange(edge.first);
+        std::cout << ": " << edge.second << " \n";
+      }
+    }
+
+    std::cout << "} \n";
+  }
+
+  void printFrozen() const {
+    std::cout << "EpsilonTransitions \n";
+
+    for (int state = 0; state < this->stateCounter; state++) {
+      if (this->epsilonOffsets[state] == this->epsilonOffsets[state + 1]) {
+        continue;
+      }
+      std::cout << "+ " << state << " -> [ ";
+      for (int i = this->epsilonOffsets[state];
+           i < this->epsilonOffsets[state + 1]; i++) {
+        std::cout << this->epsilonTargets[i] << ", ";
+      }
+      std::cout << " ] \n";
+    }
+
+    std::cout << "Transitions \n";
+
+    for (int state = 0; state < this->stateCounter; state++) {
+      if (this->edgeOffsets[state] == this->edgeOffsets[state + 1]) {
+        continue;
+      }
+      std::cout << "+ From " << state << std::endl;
+      for (int i = this->edgeOffsets[state]; i < this->edgeOffsets[state + 1];
+           i++) {
+        std::cout << "\tGiven Symbol ";
+        printRange(this->edgeRanges[i]);
+        std::cout << ": " << this->edgeTargets[i] << " \n";
+      }
+    }
+
+    std::cout << "} \n";
+  }
+};
+
+/*
+ * Deterministic automaton compiled from an Nfa with the subset construction.
+ * Every DFA state stands for the set of NFA states the simulation could be in,
+ * so matching no longer has to track sets at all: transitions are a dense
+ * state x byte class table and each input byte costs a class lookup plus a
+ * transition lookup.
+ */
+class Dfa {
+private:
+  ByteClasses byteClasses;
+  // row s holds the successors of state s, one column per byte class
+  std::vector<int> transitions;
+  std::vector<char> acceptingStates;
+  int stride = 1;
+  int stateCounter = 0;
+
+  void setByteClasses(const ByteClasses &byteClasses) {
+    this->byteClasses = byteClasses;
+    this->stride = byteClasses.size();
+  }
+
+  int createNewState(bool accepting) {
+    this->transitions.resize(this->transitions.size() + this->stride,
+                             deadState);
+    this->acceptingStates.push_back(accepting);
+    this->stateCounter++;
+    return this->stateCounter - 1;
+  }
+
+  // how fromNfa and leftmostFirstFromNfa turn NFA states into DFA states
+  enum class Construction { Anchored, Unanchored, LeftmostFirst };
+
+  // marks the subsets of a leftmost-first search that already matched
+  static constexpr int matchedMarker = -1;
+
+  // drops every thread behind the first one that matched, true if one did
+  static bool keepUntilMatch(const Nfa &nfa, SparseSet &states) {
+    int kept = 0;
+    for (int state : states) {
+      kept++;
+      if (nfa.isAccepting(state)) {
+        states.truncate(kept);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // sorted NFA state sets identify DFA states, except for leftmost-first
+  // searches where the order of the threads is part of the state
+  static std::vector<int> subsetKey(const SparseSet &states,
+                                    Construction construction,
+                                    bool matched) {
+    std::vector<int> subset(states.begin(), states.end());
+    if (construction != Construction::LeftmostFirst) {
+      std::sort(subset.begin(), subset.end());
+    } else if (matched) {
+      subset.push_back(matchedMarker);
+    }
+    return subset;
+  }
+
+  static std::unique_ptr<Dfa> determinize(const Nfa &nfa,
+                                          Construction construction,
+                                          int maxStates) {
+    std::unique_ptr<Dfa> dfa = std::make_unique<Dfa>();
+    dfa->setByteClasses(nfa.getByteClasses());
+    size_t subsetStatesLeft = size_t(maxStates) * subsetBudget;
+    bool unanchored = construction == Construction::Unanchored;
+    bool leftmost = construction == Construction::LeftmostFirst;
+
+    std::map<std::vector<int>, int> subsetToState;
+    std::vector<std::vector<int>> subsets;
+
+    SparseSet current(nfa.getStateCount());
+    SparseSet next(nfa.getStateCount());
+    SparseSet entered(nfa.getStateCount());
+
+    subsetToState[std::vector<int>()] = dfa->createNewState(false);
+    subsets.push_back(std::vector<int>());
+
+    nfa.addStartClosure(current);
+    bool startMatched = leftmost && keepUntilMatch(nfa, current);
+    std::vector<int> startSubset =
+        subsetKey(current, construction, startMatched);
+    subsetToState[startSubset] =
+        dfa->createNewState(nfa.containsFinalState(current));
+    subsets.push_back(startSubset);
+
+    // subsets doubles as the work list, every state discovered is appended
+    // and gets its row filled in once the loop reaches it
+    for (int state = startState; state < dfa->stateCounter; state++) {
+      current.clear();
+      bool matched = false;
+      for (int nfaState : subsets[state]) {
+        if (nfaState == matchedMarker) {
+          matched = true;
+        } else {
+          current.insert(nfaState);
+        }
+      }
+
+      if (unanchored && dfa->acceptingStates[state]) {
+        for (int byteClass = 0; byteClass < dfa->stride; byteClass++) {
+          dfa->transitions[state * dfa->stride + byteClass] = state;
+        }
+        continue;
+      }
+
+      for (int byteClass = 0; byteClass < dfa->stride; byteClass++) {
+        // every byte of a class leads to the same states
+        nfa.step(current,
+                 static_cast<char>(
+                     dfa->byteClasses.getRepresentative(byteClass)),
+                 next, entered);
+        bool nextMatched = matched;
+        if (unanchored) {
+          nfa.addStartClosure(next);
+        } else if (leftmost) {
+          // new threads start behind the old ones until something matched
+          nextMatched = keepUntilMatch(nfa, next) || matched;
+          if (!nextMatched) {
+            nfa.addStartClosure(next);
+            nextMatched = keepUntilMatch(nfa, next);
+          }
+        }
+        if (next.empty()) {
+          continue;
+        }
+
+        std::vector<int> subset = subsetKey(next, construction, nextMatched);
+
+        std::map<std::vector<int>, int>::iterator found =
+            subsetToState.find(subset);
+        int toState;
+        if (found != subsetToState.end()) {
+          toState = found->second;
+        } else {
+          if (dfa->stateCounter == maxStates ||
+              subset.size() > subsetStatesLeft) {
+            return nullptr;
+          }
+          subsetStatesLeft -= subset.size();
+          toState = dfa->createNewState(nfa.containsFinalState(next));
+          subsetToState[subset] = toState;
+          subsets.push_back(subset);
+        }
+        dfa->transitions[state * dfa->stride + byteClass] = toState;
+      }
+    }
+
+    return dfa;
+  }
+
+public:
+  // the empty set of NFA states, once entered nothing can match anymore
+  static constexpr int deadState = 0;
+  static constexpr int startState = 1;
+  static constexpr size_t subsetBudget = 16;
+
+  Dfa() {}
+
+  /*
+   * An unanchored DFA accepts every input that contains a match anywhere: the
+   * start state is folded into every subset so a match can begin at any
+   * position, and accepting states loop back to themselves so a match found
+   * halfway through is not forgotten. Returns nullptr once more than
+   * maxStates states would be needed, or once the subsets behind them hold
+   * more than subsetBudget NFA states per allowed DFA state in total: large
+   * NFAs make for large subsets, and the time spent on a DFA state grows with
+   * its subset.
+   */
+  static std::unique_ptr<Dfa>
+  fromNfa(const Nfa &nfa, bool unanchored = false,
+          int maxStates = std::numeric_limits<int>::max()) {
+    return determinize(nfa,
+                       unanchored ? Construction::Unanchored
+                                  : Construction::Anchored,
+                       maxStates);
+  }
+
+  /*
+   * The leftmost-first search of Nfa::search as a DFA: its states keep the
+   * NFA threads in priority order, new threads join at the back until one
+   * of them matched, and every thread behind the first one that matched is
+   * dropped. Run from a position with longestMatchEnd, the last position it
+   * accepts at is where the leftmost-first match from there ends.
+   */
+  static std::unique_ptr<Dfa>
+  leftmostFirstFromNfa(const Nfa &nfa,
+                       int maxStates = std::numeric_limits<int>::max()) {
+    return determinize(nfa, Construction::LeftmostFirst, maxStates);
+  }
+
+  /*
+   * Hopcroft's partition refinement. States start out split into accepting
+   * and rejecting blocks, and a block is split whenever some of its states
+   * move into a splitter block over a symbol while others do not. Only the
+   * smaller half of every split is queued as a new splitter, which keeps the
+   * refinement at O(n log n) splits. Once nothing splits anymore every block
+   * is a state of the minimal DFA. States that cannot reach an accepting
+   * state all end up in the block of the dead state, and states that cannot
+   * be reached from the start state are pruned before refining.
+   */
+  static std::unique_ptr<Dfa> minimize(const Dfa &dfa) {
+    // prune everything the start state cannot reach, the dead state is kept
+    // even when nothing leads to it so it keeps its id
+    std::vector<int> reachable = {deadState, startState};
+    std::vector<char> isReachable(dfa.stateCounter, false);
+    isReachable[deadState] = true;
+    isReachable[startState] = true;
+    for (size_t i = 1; i < reachable.size(); i++) {
+      for (int byteClass = 0; byteClass < dfa.stride; byteClass++) {
+        int toState = dfa.transitions[reachable[i] * dfa.stride + byteClass];
+        if (!isReachable[toState]) {
+          isReachable[toState] = true;
+          reachable.push_back(toState);
+        }
+      }
+    }
+
+    // reverse edges grouped by (target, byte class) in a single flat array
+    int stride = dfa.stride;
+    std::vector<int> predecessorOffsets(dfa.stateCounter * stride + 1, 0);
+    for (int state : reachable) {
+      for (int byteClass = 0; byteClass < stride; byteClass++) {
+        int toState = dfa.transitions[state * stride + byteClass];
+        predecessorOffsets[toState * stride + byteClass + 1]++;
+      }
+    }
+    for (size_t i = 1; i < predecessorOffsets.size(); i++) {
+      predecessorOffsets[i] += predecessorOffsets[i - 1];
+    }
+    std::vector<int> predecessors(predecessorOffsets.back());
+    std::vector<int> fill(predecessorOffsets.begin(),
+                          predecessorOffsets.end() - 1);
+    for (int state : reachable) {
+      for (int byteClass = 0; byteClass < stride; byteClass++) {
+        int toState = dfa.transitions[state * stride + byteClass];
+        predecessors[fill[toState * stride + byteClass]++] = state;
+      }
+    }
+
+    std::vector<int> blockOf(dfa.stateCounter, -1);
+    std::vector<std::vector<int>> blocks;
+
+    std::vector<int> accepting;
+    std::vector<int> rejecting;
+    for (int state : reachable) {
+      if (dfa.acceptingStates[state]) {
+        accepting.push_back(state);
+      } else {
+        rejecting.push_back(state);
+      }
+    }
+    for (std::vector<int> *initial : {&rejecting, &accepting}) {
+      if (initial->empty()) {
+        continue;
+      }
+      for (int state : *initial) {
+        blockOf[state] = blocks.size();
+      }
+      blocks.push_back(*initial);
+    }
+
+    // splitters are (block, byte class) pairs
+    std::vector<std::pair<int, int>> worklist;
+    std::vector<std::vector<char>> queued;
+    for (size_t block = 0; block < blocks.size(); block++) {
+      queued.push_back(std::vector<char>(stride, false));
+    }
+    int smallest = 0;
+    if (blocks.size() == 2 && blocks[1].size() < blocks[0].size()) {
+      smallest = 1;
+    }
+    for (int byteClass = 0; byteClass < stride; byteClass++) {
+      worklist.push_back(std::make_pair(smallest, byteClass));
+      queued[smallest][byteClass] = true;
+    }
+
+    // where every state sits in its block, so the marked states of a block
+    // can be moved out of it without looking at the others
+    std::vector<int> positionInBlock(dfa.stateCounter, -1);
+    for (const std::vector<int> &block : blocks) {
+      for (size_t i = 0; i < block.size(); i++) {
+        positionInBlock[block[i]] = i;
+      }
+    }
+
+    std::vector<int> marked;
+    std::vector<char> isMarked(dfa.stateCounter, false);
+    std::vector<int> touchedBlocks;
+    // there are never more blocks than states, entries are only non zero for
+    // the touched blocks of the splitter at hand
+    std::vector<int> markedInBlock(dfa.stateCounter, 0);
+    std::vector<std::vector<int>> markedStates(dfa.stateCounter);
+
+    while (!worklist.empty()) {
+      std::pair<int, int> splitter = worklist[worklist.size() - 1];
+      worklist.pop_back();
+      queued[splitter.first][splitter.second] = false;
+
+      // every state that moves into the splitter block over its byte class
+      marked.clear();
+      for (int state : blocks[splitter.first]) {
+        int key = state * stride + splitter.second;
+        for (int i = predecessorOffsets[key]; i < predecessorOffsets[key + 1];
+             i++) {
+          int predecessor = predecessors[i];
+          if (!isMarked[predecessor]) {
+            isMarked[predecessor] = true;
+            marked.push_back(predecessor);
+          }
+        }
+      }
+
+      touchedBlocks.clear();
+      for (int state : marked) {
+        if (markedInBlock[blockOf[state]] == 0) {
+          touchedBlocks.push_back(blockOf[state]);
+        }
+        markedInBlock[blockOf[state]]++;
+        markedStates[blockOf[state]].push_back(state);
+      }
+
+      for (int block : touchedBlocks) {
+        if (markedInBlock[block] == static_cast<int>(blocks[block].size())) {
+          continue;
+        }
+
+        // move the marked states into a new block, swapping the last state
+        // of the old block into each hole
+        int newBlock = blocks.size();
+        std::vector<int> inside;
+        std::vector<int> &outside = blocks[block];
+        for (int state : markedStates[block]) {
+          int last = outside.back();
+          outside[positionInBlock[state]] = last;
+          positionInBlock[last] = positionInBlock[state];
+          outside.pop_back();
+          positionInBlock[state] = inside.size();
+          blockOf[state] = newBlock;
+          inside.push_back(state);
+        }
+        blocks.push_back(std::move(inside));
+        queued.push_back(std::vector<char>(stride, false));
+
+        for (int byteClass = 0; byteClass < stride; byteClass++) {
+          // a queued block has to be refined by both halves, otherwise the
+          // smaller half is enough
+          int toQueue = newBlock;
+          if (!queued[block][byteClass] &&
+              blocks[block].size() < blocks[newBlock].size()) {
+            toQueue = block;
+          }
+          if (!queued[toQueue][byteClass]) {
+            queued[toQueue][byteClass] = true;
+            worklist.push_back(std::make_pair(toQueue, byteClass));
+          }
+        }
+      }
+
+      for (int block : touchedBlocks) {
+        markedInBlock[block] = 0;
+        markedStates[block].clear();
+      }
+      for (int state : marked) {
+        isMarked[state] = false;
+      }
+    }
+
+    // number the blocks breadth first from the start state so that states
+    // that follow each other tend to sit next to each other in the table
+    std::unique_ptr<Dfa> minimal = std::make_unique<Dfa>();
+    minimal->setByteClasses(dfa.byteClasses);
+    std::vector<int> blockToState(blocks.size(), -1);
+    std::vector<int> order = {blockOf[deadState], blockOf[startState]};
+    blockToState[blockOf[deadState]] = minimal->createNewState(false);
+    if (blockOf[startState] == blockOf[deadState]) {
+      // the start state cannot accept anything, which only leaves an empty
+      // start state pointing to dead
+      minimal->createNewState(false);
+      return minimal;
+    }
+    blockToState[blockOf[startState]] =
+        minimal->createNewState(dfa.acceptingStates[startState]);
+
+    for (size_t i = 1; i < order.size(); i++) {
+      int representative = blocks[order[i]][0];
+      int fromState = blockToState[order[i]];
+      for (int byteClass = 0; byteClass < stride; byteClass++) {
+        int toBlock =
+            blockOf[dfa.transitions[representative * stride + byteClass]];
+        if (blockToState[toBlock] == -1) {
+          blockToState[toBlock] = minimal->createNewState(
+              dfa.acceptingStates[blocks[toBlock][0]]);
+          order.push_back(toBlock);
+        }
+        minimal->transitions[fromState * stride + byteClass] =
+            blockToState[toBlock];
+      }
+    }
+
+    return minimal;
+  }
+
+  int getStateCount() const { return this->stateCounter; }
+
+  int getClassCount() const { return this->stride; }
+
+  size_t getMemoryUsed() const {
+    return sizeof(Dfa) + sizeof(int) * this->transitions.size() +
+           this->acceptingStates.size();
+  }
+
+  const ByteClasses &getByteClasses() const { return this->byteClasses; }
+
+  int getClassTransition(int state, int byteClass) const {
+    return this->transitions[state * this->stride + byteClass];
+  }
+
+  int getTransition(int state, unsigned char c) const {
+    return this->transitions[state * this->stride + this->byteClasses.get(c)];
+  }
+
+  bool isAccepting(int state) const { return this->acceptingStates[state]; }
+
+  // runs from input[from] on until the dead state, false if it never
+  // accepted, otherwise end is just past the last byte it accepted after
+  bool longestMatchEnd(std::string_view input, size_t from,
+                       size_t &end) const {
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int stride = this->stride;
+    int state = startState;
+    bool accepted = this->acceptingStates[state];
+    end = from;
+    for (size_t position = from; position < input.size(); position++) {
+      state = table[state * stride +
+                    classes[static_cast<unsigned char>(input[position])]];
+      if (state == deadState) {
+        break;
+      }
+      if (this->acceptingStates[state]) {
+        accepted = true;
+        end = position + 1;
+      }
+    }
+    return accepted;
+  }
+
+  // the same walking backwards from input[end - 1] down to input[from], for
+  // the DFA of a reversed pattern: start is the lowest position for which
+  // input[start, end) is a match
+  bool longestMatchStart(std::string_view input, size_t from, size_t end,
+                         size_t &start) const {
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int stride = this->stride;
+    int state = startState;
+    bool accepted = this->acceptingStates[state];
+    start = end;
+    for (size_t position = end; position > from; position--) {
+      state = table[state * stride +
+                    classes[static_cast<unsigned char>(input[position - 1])]];
+      if (state == deadState) {
+        break;
+      }
+      if (this->acceptingStates[state]) {
+        accepted = true;
+        start = position - 1;
+      }
+    }
+    return accepted;
+  }
+
+  bool runSimulation(std::string_view input) const {
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int stride = this->stride;
+    int state = startState;
+    for (unsigned char c : input) {
+      state = table[state * stride + classes[c]];
+    }
+    return this->acceptingStates[state];
+  }
+
+  /*
+   * Where every state ends up after consuming [begin, end). All states are
+   * advanced together as independent lanes, and every few bytes lanes that
+   * reached the same state are merged since they will stay together from
+   * there on. Most DFAs synchronize after a handful of bytes, after which a
+   * single lane runs at the speed of runSimulation.
+   */
+  std::vector<int> mapChunk(const unsigned char *begin,
+                            const unsigned char *end) const {
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int stride = this->stride;
+
+    std::vector<int> lanes(this->stateCounter);
+    std::vector<int> laneOf(this->stateCounter);
+    for (int state = 0; state < this->stateCounter; state++) {
+      lanes[state] = state;
+      laneOf[state] = state;
+    }
+
+    std::vector<int> laneOfState(this->stateCounter, -1);
+    std::vector<int> mergedLanes;
+    std::vector<int> renumbered;
+
+    const unsigned char *position = begin;
+    while (position < end && lanes.size() > 1) {
+      const unsigned char *blockEnd =
+          position + std::min<ptrdiff_t>(64, end - position);
+      for (; position < blockEnd; position++) {
+        int byteClass = classes[*position];
+        for (int &lane : lanes) {
+          lane = table[lane * stride + byteClass];
+        }
+      }
+
+      mergedLanes.clear();
+      renumbered.resize(lanes.size());
+      for (size_t i = 0; i < lanes.size(); i++) {
+        if (laneOfState[lanes[i]] == -1) {
+          laneOfState[lanes[i]] = mergedLanes.size();
+          mergedLanes.push_back(lanes[i]);
+        }
+        renumbered[i] = laneOfState[lanes[i]];
+      }
+      for (int lane : mergedLanes) {
+        laneOfState[lane] = -1;
+      }
+      for (int &lane : laneOf) {
+        lane = renumbered[lane];
+      }
+      std::swap(lanes, mergedLanes);
+    }
+
+    if (lanes.size() == 1) {
+      int state = lanes[0];
+      for (; position < end; position++) {
+        state = table[state * stride + classes[*position]];
+      }
+      lanes[0] = state;
+    }
+
+    std::vector<int> endStates(this->stateCounter);
+    for (int state = 0; state < this->stateCounter; state++) {
+      endStates[state] = lanes[laneOf[state]];
+    }
+    return endStates;
+  }
+
+  /*
+   * Same answer as runSimulation, but the input is cut into one chunk per
+   * thread. The first chunk runs from the start state as usual; all other
+   * chunks can not know the state they begin in, so they compute where every
+   * state would end up with mapChunk. Stitching the chunks together is then
+   * one lookup per chunk. Inputs too small to give every thread at least
+   * minChunkSize bytes use fewer threads.
+   */
+  bool runSimulationParallel(std::string_view input, int threadCount,
+                             size_t minChunkSize = 1 << 20) const {
+    size_t chunkCount = std::min<size_t>(
+        std::max(threadCount, 1), input.size() / std::max<size_t>(
+                                                     minChunkSize, 1));
+    if (chunkCount <= 1) {
+      return this->runSimulation(input);
+    }
+
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(input.data());
+    size_t chunkSize = input.size() / chunkCount;
+
+    std::vector<std::vector<int>> chunkMappings(chunkCount);
+    std::vector<std::thread> workers;
+    for (size_t chunk = 1; chunk < chunkCount; chunk++) {
+      const unsigned char *begin = data + chunk * chunkSize;
+      const unsigned char *end = chunk + 1 == chunkCount
+                                     ? data + input.size()
+                                     : data + (chunk + 1) * chunkSize;
+      workers.push_back(std::thread([this, &chunkMappings, chunk, begin, end] {
+        chunkMappings[chunk] = this->mapChunk(begin, end);
+      }));
+    }
+
+    // the first chunk knows its start state, it runs on the calling thread
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int state = startState;
+    for (const unsigned char *position = data; position < data + chunkSize;
+         position++) {
+      state = table[state * this->stride + classes[*position]];
+    }
+
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+
+    for (size_t chunk = 1; chunk < chunkCount; chunk++) {
+      state = chunkMappings[chunk][state];
+    }
+    return this->acceptingStates[state];
+  }
+
+  static constexpr size_t interleaveWidth = 4;
+
+  /*
+   * runSimulation for count inputs at once, results[i] is set to whether
+   * inputs[i] matches. interleaveWidth inputs are scanned in lockstep:
+   * their transitions do not depend on each other, so the table loads of
+   * one input overlap with those of the others instead of each waiting on
+   * the one before as in a single scan. A lane whose input ends records its
+   * result and takes the next input, so short inputs do not hold the others
+   * back. Once no input is left to take, the ones still in the lanes are
+   * finished one at a time.
+   */
+  void runSimulationBatch(const std::string_view *inputs, size_t count,
+                          char *results) const {
+    const unsigned char *classes = this->byteClasses.data();
+    const int *table = this->transitions.data();
+    int stride = this->stride;
+
+    if (count < interleaveWidth) {
+      for (size_t i = 0; i < count; i++) {
+        results[i] = this->runSimulation(inputs[i]);
+      }
+      return;
+    }
+
+    const unsigned char *data[interleaveWidth];
+    size_t remaining[interleaveWidth];
+    size_t owner[interleaveWidth];
+    int states[interleaveWidth];
+    size_t next = 0;
+    auto load = [&](size_t lane) {
+      data[lane] = reinterpret_cast<const unsigned char *>(inputs[next].data());
+      remaining[lane] = inputs[next].size();
+      owner[lane] = next;
+      states[lane] = startState;
+      next++;
+    };
+    for (size_t lane = 0; lane < interleaveWidth; lane++) {
+      load(lane);
+    }
+
+    while (true) {
+      // every lane has input left here, step them all to the end of the
+      // shortest one
+      size_t steps = *std::min_element(remaining, remaining + interleaveWidth);
+      for (size_t i = 0; i < steps; i++) {
+        for (size_t lane = 0; lane < interleaveWidth; lane++) {
+          states[lane] = table[states[lane] * stride + classes[data[lane][i]]];
+        }
+      }
+
+      bool drained = false;
+      for (size_t lane = 0; lane < interleaveWidth; lane++) {
+        data[lane] += steps;
+        remaining[lane] -= steps;
+        while (remaining[lane] == 0 && next < count) {
+          results[owner[lane]] = this->acceptingStates[states[lane]];
+          load(lane);
+        }
+        drained |= remaining[lane] == 0;
+      }
+      if (drained) {
+        break;
+      }
+    }
+
+    for (size_t lane = 0; lane < interleaveWidth; lane++) {
+      int state = states[lane];
+      for (size_t i = 0; i < remaining[lane]; i++) {
+        state = table[state * stride + classes[data[lane][i]]];
+      }
+      results[owner[lane]] = this->acceptingStates[state];
+    }
+  }
+
+  void print() const {
+    std::cout << "DFA { \n";
+
+    std::cout << "Accepting States: \n";
+
+    for (int state = 0; state < this->stateCounter; state++) {
+      if (this->acceptingStates[state]) {
+        std::cout << "+ " << state << std::endl;
+      }
+    }
+
+    this->byteClasses.print();
+
+    std::cout << "Transitions \n";
+
+    for (int state = startState; state < this->stateCounter; state++) {
+      std::cout << "+ From " << state << std::endl;
+      for (int byteClass = 0; byteClass < this->stride; byteClass++) {
+        int toState = this->transitions[state * this->stride + byteClass];
+        if (toState != deadState) {
+          std::cout << "\tGiven Class " << byteClass << ": " << toState
+                    << " \n";
+        }
+      }
+    }
+
+    std::cout << "} \n";
+  }
+};
+
+/*
+ * DFA that is built while matching instead of up front. States are created
+ * from the NFA state sets the first time a transition is taken and cached in
+ * a table whose memory is capped by a budget, so patterns whose full DFA would
+ * explode only ever pay for the states the input actually visits. When the
+ * budget runs out the cache is flushed and rebuilt from the current state,
+ * and if that keeps happening during one search the rest of the input is
+ * handed to the plain NFA simulation.
+ */
+class LazyDfa {
+private:
+  // transition not computed yet
+  static constexpr int unknownState = -1;
+  // returned by simulate when the NFA had to finish the search
+  static constexpr int fellBackToNfa = -2;
+  static constexpr int deadState = 0;
+  static constexpr int startState = 1;
+  // flushes tolerated in a single search before giving up on the cache
+  static constexpr int maxFlushesPerSearch = 3;
+
+  const Nfa *nfa;
+  const ByteClasses *byteClasses;
+  int stride;
+  size_t memoryBudget;
+  size_t memoryUsed = 0;
+
+  std::vector<int> transitions;
+  std::vector<char> acceptingStates;
+  std::vector<std::vector<int>> subsets;
+  std::map<std::vector<int>, int> subsetToState;
+
+  SparseSet current;
+  SparseSet next;
+  SparseSet entered;
+
+  int flushCount = 0;
+  int fallbackCount = 0;
+
+  // returns unknownState when the state does not fit in the budget
+  int addState(const std::vector<int> &subset, bool accepting) {
+    size_t cost = stateCost(this->stride, subset.size());
+    if (this->memoryUsed + cost > this->memoryBudget) {
+      return unknownState;
+    }
+    this->memoryUsed += cost;
+
+    int state = this->subsets.size();
+    this->transitions.resize(this->transitions.size() + this->stride,
+                             unknownState);
+    this->acceptingStates.push_back(accepting);
+    this->subsets.push_back(subset);
+    this->subsetToState[subset] = state;
+    return state;
+  }
+
+  void loadSubset(const std::vector<int> &subset, SparseSet &states) {
+    states.clear();
+    for (int nfaState : subset) {
+      states.insert(nfaState);
+    }
+  }
+
+  // throws away every cached state, only the dead and start states survive
+  bool resetCache() {
+    this->memoryUsed = 0;
+    this->transitions.clear();
+    this->acceptingStates.clear();
+    this->subsets.clear();
+    this->subsetToState.clear();
+
+    this->addState(std::vector<int>(), false);
+
+    this->current.clear();
+    this->nfa->addStartClosure(this->current);
+    std::vector<int> startSubset(this->current.begin(), this->current.end());
+    std::sort(startSubset.begin(), startSubset.end());
+    return this->addState(startSubset,
+                          this->nfa->containsFinalState(this->current)) ==
+           startState;
+  }
+
+  // fills in the transition of state over byteClass, unknownState if the
+  // target is a new state that does not fit in the cache
+  int computeTransition(int state, int byteClass) {
+    this->loadSubset(this->subsets[state], this->current);
+    this->nfa->step(
+        this->current,
+        static_cast<char>(this->byteClasses->getRepresentative(byteClass)),
+        this->next, this->entered);
+
+    std::vector<int> subset(this->next.begin(), this->next.end());
+    std::sort(subset.begin(), subset.end());
+
+    int toState;
+    std::map<std::vector<int>, int>::iterator found =
+        this->subsetToState.find(subset);
+    if (found != this->subsetToState.end()) {
+      toState = found->second;
+    } else {
+      toState = this->addState(subset, this->nfa->containsFinalState(next));
+      if (toState == unknownState) {
+        return unknownState;
+      }
+    }
+
+    this->transitions[state * this->stride + byteClass] = toState;
+    return toState;
+  }
+
+  // finishes a search with the Thompson simulation starting from subset,
+  // current holds the states it ends in
+  int simulateFrom(const std::vector<int> &subset, std::string_view input,
+                   size_t from) {
+    this->fallbackCount++;
+    this->loadSubset(subset, this->current);
+    for (size_t i = from; i < input.size() && !this->current.empty(); i++) {
+      this->nfa->step(this->current, input[i], this->next, this->entered);
+      std::swap(this->current, this->next);
+    }
+    return fellBackToNfa;
+  }
+
+  /*
+   * Runs input through the cache and returns the state it ends in. When the
+   * search had to be finished by the NFA fellBackToNfa is returned instead
+   * and current holds the NFA states the simulation ended in.
+   */
+  int simulate(std::string_view input) {
+    if (this->subsets.empty() && !this->resetCache()) {
+      // the budget cannot even hold the start state
+      this->subsets.clear();
+      std::vector<int> startSubset;
+      this->current.clear();
+      this->nfa->addStartClosure(this->current);
+      startSubset.assign(this->current.begin(), this->current.end());
+      return this->simulateFrom(startSubset, input, 0);
+    }
+
+    int flushesThisSearch = 0;
+    int state = startState;
+
+    for (size_t i = 0; i < input.size(); i++) {
+      int byteClass = this->byteClasses->get(input[i]);
+      int toState = this->transitions[state * this->stride + byteClass];
+
+      if (toState == unknownState) {
+        toState = this->computeTransition(state, byteClass);
+      }
+
+      if (toState == unknownState) {
+        // out of memory, start over with an empty cache holding only the
+        // state we are currently in
+        std::vector<int> subset = this->subsets[state];
+        if (flushesThisSearch == maxFlushesPerSearch) {
+          return this->simulateFrom(subset, input, i);
+        }
+
+        flushesThisSearch++;
+        this->flushCount++;
+        this->resetCache();
+
+        std::map<std::vector<int>, int>::iterator found =
+            this->subsetToState.find(subset);
+        if (found != this->subsetToState.end()) {
+          state = found->second;
+        } else {
+          this->loadSubset(subset, this->current);
+          state = this->addState(subset,
+                                 this->nfa->containsFinalState(this->current));
+        }
+
+        if (state != unknownState) {
+          toState = this->computeTransition(state, byteClass);
+        }
+        if (toState == unknownState) {
+          return this->simulateFrom(subset, input, i);
+        }
+      }
+
+      if (toState == deadState) {
+        return deadState;
+      }
+      state = toState;
+    }
+
+    return state;
+  }
+
+public:
+  // the nfa has to outlive the cache built on top of it
+  LazyDfa(const Nfa &nfa, size_t memoryBudget)
+      : nfa(&nfa), byteClasses(&nfa.getByteClasses()),
+        stride(nfa.getByteClasses().size()), memoryBudget(memoryBudget),
+        current(nfa.getStateCount()), next(nfa.getStateCount()),
+        entered(nfa.getStateCount()) {}
+
+  // rough footprint of a cached state: its row, its subset and the copy of
+  // the subset used as the lookup key
+  static size_t stateCost(int classCount, size_t subsetSize) {
+    return classCount * sizeof(int) + 2 * sizeof(std::vector<int>) +
+           2 * subsetSize * sizeof(int);
+  }
+
+  int getStateCount() const { return this->subsets.size(); }
+
+  size_t getMemoryUsed() const { return this->memoryUsed; }
+
+  int getFlushCount() const { return this->flushCount; }
+
+  int getFallbackCount() const { return this->fallbackCount; }
+
+  bool runSimulation(std::string_view input) {
+    int state = this->simulate(input);
+    if (state == fellBackToNfa) {
+      return this->nfa->containsFinalState(this->current);
+    }
+    return this->acceptingStates[state];
+  }
+
+  // ids of every pattern of a combined automaton that matches input
+  std::vector<int> getMatchedPatterns(std::string_view input) {
+    int state = this->simulate(input);
+    if (state != fellBackToNfa) {
+      this->loadSubset(this->subsets[state], this->current);
+    }
+    return this->nfa->getMatchedPatterns(this->current);
+  }
+};
+
+/*
+ * Syntax tree of a pattern. Nodes live in one vector and refer to each other
+ * by index, the operands of a concatenation or alternation are a contiguous
+ * slice of children. Parsing is a single recursive descent pass, one call
+ * per level of the grammar (loosest binding first):
+ *
+ *   alternation   = concatenation ('|' concatenation)*
+ *   concatenation = repetition (['+'] repetition)*
+ *   repetition    = atom ('*' | '{' count [',' [count]] '}')*
+ *   atom          = '(' alternation ')' | '[' class ']' | '.'
+ *                 | '\' escape | any other byte
+ *
+ * '+' is an explicit concatenation so that patterns written for the old
+ * postfix front end ("a+b", "d+(a*)") keep their meaning. Escaped operators
+ * are literals, and \n \t \r \f \v \0 and \xHH stand for the usual bytes.
+ * An empty pattern, alternative or group matches the empty string.
+ *
+ * A class is a set of bytes: [a-z_], negated with [^...], '.' for anything
+ * but a newline, \d \w \s for the ASCII digits, word characters and
+ * whitespace and \D \W \S for their complements. Classes are stored as
+ * sorted ranges, which become one NFA edge each. A class holding a single
+ * byte is a literal.
+ *
+ * x{n} repeats x exactly n times, x{n,} at least n times and x{n,m} between
+ * n and m times. x{0,} is x* and x{1} is x.
+ */
+enum class AstKind {
+  Empty,
+  Literal,
+  Class,
+  Concatenation,
+  Alternation,
+  Star,
+  Repeat,
+  Group
+};
+
+struct AstNode {
+  AstKind kind = AstKind::Empty;
+  unsigned char byte = 0;
+  // operands in RegexAst::children, a star has exactly one
+  int firstChild = 0;
+  int childCount = 0;
+  // bytes of a class in RegexAst::ranges, disjoint and in ascending order
+  int firstRange = 0;
+  int rangeCount = 0;
+  // bounds of a repeat, maxCount is -1 when there is no upper bound
+  int minCount = 0;
+  int maxCount = 0;
+  // number of a capture group, counted from 1 by its opening parenthesis
+  int group = 0;
+};
+
+class RegexAst {
+public:
+  static constexpr int maxRepeatCount = 1 << 20;
+  // automata with every repetition written out are only built up to this
+  // many nodes, see getExpandedSize
+  static constexpr size_t maxExpandedSize = 1 << 16;
+
+private:
+  // deeper nesting than this is rejected instead of overflowing the stack
+  static constexpr int maxDepth = 1000;
+
+  std::vector<AstNode> nodes;
+  std::vector<int> children;
+  std::vector<ByteRange> ranges;
+  int root = -1;
+  int groupCount = 0;
+
+  std::string_view pattern;
+  size_t position = 0;
+  int depth = 0;
+
+  [[noreturn]] void fail(const std::string &reason) const {
+    throw std::invalid_argument("Invalid regex: " + reason + " at " +
+                                std::to_string(this->position));
+  }
+
+  int addNode(AstKind kind, unsigned char byte,
+              const std::vector<int> &operands) {
+    AstNode node;
+    node.kind = kind;
+    node.byte = byte;
+    node.firstChild = this->children.size();
+    node.childCount = operands.size();
+    this->children.insert(this->children.end(), operands.begin(),
+                          operands.end());
+    this->nodes.push_back(node);
+    return this->nodes.size() - 1;
+  }
+
+  // a literal when bytes holds exactly one byte, a class otherwise
+  int addClass(const std::array<bool, 256> &bytes) {
+    AstNode node;
+    node.kind = AstKind::Class;
+    node.firstRange = this->ranges.size();
+    for (int byte = 0; byte < 256; byte++) {
+      if (!bytes[byte]) {
+        continue;
+      }
+      int last = byte;
+      while (last + 1 < 256 && bytes[last + 1]) {
+        last++;
+      }
+      this->ranges.push_back(ByteRange{static_cast<unsigned char>(byte),
+                                       static_cast<unsigned char>(last)});
+      byte = last;
+    }
+    node.rangeCount = this->ranges.size() - node.firstRange;
+
+    if (node.rangeCount == 1 &&
+        this->ranges.back().from == this->ranges.back().to) {
+      node.kind = AstKind::Literal;
+      node.byte = this->ranges.back().from;
+      node.firstRange = 0;
+      node.rangeCount = 0;
+      this->ranges.pop_back();
+    }
+    this->nodes.push_back(node);
+    return this->nodes.size() - 1;
+  }
+
+  bool atEnd() const { return this->position == this->pattern.size(); }
+
+  char peek() const { return this->pattern[this->position]; }
+
+  // true when the escape \c stands for a class rather than a byte
+  static bool isClassEscape(char c) {
+    return c == 'd' || c == 'D' || c == 'w' || c == 'W' || c == 's' ||
+           c == 'S';
+  }
+
+  static void addClassEscape(char c, std::array<bool, 256> &bytes) {
+    std::array<bool, 256> named = {};
+    switch (c) {
+    case 'd':
+    case 'D':
+      for (int byte = '0'; byte <= '9'; byte++) {
+        named[byte] = true;
+      }
+      break;
+    case 'w':
+    case 'W':
+      for (int byte = 0; byte < 128; byte++) {
+        named[byte] = std::isalnum(byte) || byte == '_';
+      }
+      break;
+    default:
+      for (char space : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        named[static_cast<unsigned char>(space)] = true;
+      }
+      break;
+    }
+    bool negated = std::isupper(static_cast<unsigned char>(c));
+    for (int byte = 0; byte < 256; byte++) {
+      if (named[byte] != negated) {
+        bytes[byte] = true;
+      }
+    }
+  }
+
+  static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return -1;
+  }
+
+  // the byte an escape stands for, position is just past the backslash
+  unsigned char parseEscape() {
+    if (this->atEnd()) {
+      this->fail("trailing backslash");
+    }
+    char c = this->pattern[this->position++];
+    switch (c) {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'v':
+      return '\v';
+    case '0':
+      return '\0';
+    case 'x': {
+      if (this->pattern.size() - this->position < 2 ||
+          hexValue(this->pattern[this->position]) == -1 ||
+          hexValue(this->pattern[this->position + 1]) == -1) {
+        this->fail("\\x needs two hex digits");
+      }
+      int value = hexValue(this->pattern[this->position]) * 16 +
+                  hexValue(this->pattern[this->position + 1]);
+      this->position += 2;
+      return value;
+    }
+    default:
+      // letters and digits are kept free for escapes added later
+      if (std::isalnum(static_cast<unsigned char>(c))) {
+        this->position--;
+        this->fail(std::string("unknown escape \\") + c);
+      }
+      return c;
+    }
+  }
+
+  // a byte inside brackets, where only the backslash is special
+  unsigned char parseClassByte() {
+    char c = this->pattern[this->position++];
+    if (c == '\\') {
+      if (!this->atEnd() && isClassEscape(this->peek())) {
+        this->fail("class escape used as a range bound");
+      }
+      return this->parseEscape();
+    }
+    return c;
+  }
+
+  // position is just past the '['. A ']' right after the '[' or '[^' is a
+  // member, so is a '-' that cannot start a range.
+  int parseClass() {
+    std::array<bool, 256> bytes = {};
+    bool negated = !this->atEnd() && this->peek() == '^';
+    if (negated) {
+      this->position++;
+    }
+
+    bool first = true;
+    while (true) {
+      if (this->atEnd()) {
+        this->fail("missing ]");
+      }
+      if (this->peek() == ']' && !first) {
+        this->position++;
+        break;
+      }
+      first = false;
+
+      if (this->peek() == '\\' &&
+          this->position + 1 < this->pattern.size() &&
+          isClassEscape(this->pattern[this->position + 1])) {
+        addClassEscape(this->pattern[this->position + 1], bytes);
+        this->position += 2;
+        continue;
+      }
+
+      unsigned char low = this->parseClassByte();
+      unsigned char high = low;
+      if (this->pattern.size() - this->position >= 2 && this->peek() == '-' &&
+          this->pattern[this->position + 1] != ']') {
+        this->position++;
+        size_t bound = this->position;
+        high = this->parseClassByte();
+        if (high < low) {
+          this->position = bound;
+          this->fail("range out of order");
+        }
+      }
+      for (int byte = low; byte <= high; byte++) {
+        bytes[byte] = true;
+      }
+    }
+
+    if (negated) {
+      for (bool &member : bytes) {
+        member = !member;
+      }
+    }
+    return this->addClass(bytes);
+  }
+
+  int parseAtom() {
+    char c = this->peek();
+    if (c == '(') {
+      if (++this->depth > maxDepth) {
+        this->fail("groups nested too deeply");
+      }
+      this->position++;
+      int number = ++this->groupCount;
+      int inner = this->parseAlternation();
+      if (this->atEnd() || this->peek() != ')') {
+        this->fail("missing )");
+      }
+      this->position++;
+      this->depth--;
+      int group = this->addNode(AstKind::Group, 0, {inner});
+      this->nodes[group].group = number;
+      return group;
+    }
+    this->position++;
+    if (c == '[') {
+      return this->parseClass();
+    }
+    if (c == '.') {
+      std::array<bool, 256> bytes;
+      bytes.fill(true);
+      bytes['\n'] = false;
+      return this->addClass(bytes);
+    }
+    if (c == '\\') {
+      if (!this->atEnd() && isClassEscape(this->peek())) {
+        std::array<bool, 256> bytes = {};
+        addClassEscape(this->pattern[this->position++], bytes);
+        return this->addClass(bytes);
+      }
+      return this->addNode(AstKind::Literal, this->parseEscape(), {});
+    }
+    return this->addNode(AstKind::Literal, c, {});
+  }
+
+  int parseCount() {
+    if (this->atEnd() || !std::isdigit(static_cast<unsigned char>(
+                             this->peek()))) {
+      this->fail("repetition count expected");
+    }
+    int count = 0;
+    while (!this->atEnd() &&
+           std::isdigit(static_cast<unsigned char>(this->peek()))) {
+      count = count * 10 + (this->peek() - '0');
+      if (count > maxRepeatCount) {
+        this->fail("repetition count above " + std::to_string(maxRepeatCount));
+      }
+      this->position++;
+    }
+    return count;
+  }
+
+  // the node repeating node as given by the bounds, position is just past
+  // the '{'
+  int parseBounds(int node) {
+    int minCount = this->parseCount();
+    int maxCount = minCount;
+    if (!this->atEnd() && this->peek() == ',') {
+      this->position++;
+      if (!this->atEnd() && this->peek() == '}') {
+        maxCount = -1;
+      } else {
+        maxCount = this->parseCount();
+      }
+    }
+    if (this->atEnd() || this->peek() != '}') {
+      this->fail("missing }");
+    }
+    if (maxCount != -1 && maxCount < minCount) {
+      this->fail("repetition bounds out of order");
+    }
+    this->position++;
+
+    if (minCount == 0 && maxCount == -1) {
+      return this->addStar(node);
+    }
+    if (minCount == 1 && maxCount == 1) {
+      return node;
+    }
+    int repeat = this->addNode(AstKind::Repeat, 0, {node});
+    this->nodes[repeat].minCount = minCount;
+    this->nodes[repeat].maxCount = maxCount;
+    return repeat;
+  }
+
+  int addStar(int node) {
+    // (x*)* is x*
+    if (this->nodes[node].kind == AstKind::Star) {
+      return node;
+    }
+    return this->addNode(AstKind::Star, 0, {node});
+  }
+
+  int parseRepetition() {
+    int node = this->parseAtom();
+    int outer = node;
+    int wrapped = 0;
+    while (!this->atEnd() && (this->peek() == '*' || this->peek() == '{')) {
+      char c = this->peek();
+      this->position++;
+      node = c == '*' ? this->addStar(node) : this->parseBounds(node);
+      if (node != outer) {
+        // every operator is a level of the tree as well
+        outer = node;
+        wrapped++;
+        if (++this->depth > maxDepth) {
+          this->fail("repetitions nested too deeply");
+        }
+      }
+    }
+    this->depth -= wrapped;
+    return node;
+  }
+
+  int parseConcatenation() {
+    std::vector<int> operands;
+    while (!this->atEnd()) {
+      char c = this->peek();
+      if (c == '|' || c == ')') {
+        break;
+      }
+      if (c == '+') {
+        if (operands.empty()) {
+          this->fail("+ without a left operand");
+        }
+        this->position++;
+        if (this->atEnd() || this->peek() == '|' || this->peek() == ')' ||
+            this->peek() == '+') {
+          this->fail("+ without a right operand");
+        }
+        continue;
+      }
+      if (c == '*' || c == '{') {
+        this->fail(std::string(1, c) + " without an operand");
+      }
+      operands.push_back(this->parseRepetition());
+    }
+
+    if (operands.empty()) {
+      return this->addNode(AstKind::Empty, 0, {});
+    }
+    if (operands.size() == 1) {
+      return operands[0];
+    }
+    return this->addNode(AstKind::Concatenation, 0, operands);
+  }
+
+  int parseAlternation() {
+    std::vector<int> operands = {this->parseConcatenation()};
+    while (!this->atEnd() && this->peek() == '|') {
+      this->position++;
+      operands.push_back(this->parseConcatenation());
+    }
+    if (operands.size() == 1) {
+      return operands[0];
+    }
+    return this->addNode(AstKind::Alternation, 0, operands);
+  }
+
+  static void appendByte(unsigned char byte, std::string &out) {
+    if (std::isgraph(byte)) {
+      out += static_cast<char>(byte);
+    } else {
+      const char *digits = "0123456789abcdef";
+      out += "\\x";
+      out += digits[byte >> 4];
+      out += digits[byte & 15];
+    }
+  }
+
+  void appendString(int index, std::string &out) const {
+    const AstNode &node = this->nodes[index];
+    switch (node.kind) {
+    case AstKind::Empty:
+      out += "empty";
+      return;
+    case AstKind::Literal:
+      appendByte(node.byte, out);
+      return;
+    case AstKind::Class:
+      out += "[";
+      for (int i = 0; i < node.rangeCount; i++) {
+        ByteRange range = this->getRange(node, i);
+        appendByte(range.from, out);
+        if (range.to != range.from) {
+          out += "-";
+          appendByte(range.to, out);
+        }
+      }
+      out += "]";
+      return;
+    case AstKind::Concatenation:
+      out += "cat(";
+      break;
+    case AstKind::Alternation:
+      out += "alt(";
+      break;
+    case AstKind::Star:
+      out += "star(";
+      break;
+    case AstKind::Repeat:
+      out += "rep(";
+      break;
+    case AstKind::Group:
+      out += "group(";
+      break;
+    }
+    for (int i = 0; i < node.childCount; i++) {
+      if (i > 0) {
+        out += ",";
+      }
+      this->appendString(this->getChild(node, i), out);
+    }
+    if (node.kind == AstKind::Repeat) {
+      out += "," + std::to_string(node.minCount) + ",";
+      if (node.maxCount != -1) {
+        out += std::to_string(node.maxCount);
+      }
+    }
+    if (node.kind == AstKind::Group) {
+      out += "," + std::to_string(node.group);
+    }
+    out += ")";
+  }
+
+  size_t expandedSize(int index) const {
+    const AstNode &node = this->nodes[index];
+    size_t size = 0;
+    for (int i = 0; i < node.childCount; i++) {
+      size_t child = this->expandedSize(this->getChild(node, i));
+      size = child > std::numeric_limits<size_t>::max() - size
+                 ? std::numeric_limits<size_t>::max()
+                 : size + child;
+    }
+    if (node.kind == AstKind::Repeat) {
+      size_t copies = node.maxCount == -1 ? size_t(node.minCount) + 1
+                                          : size_t(node.maxCount);
+      size = copies != 0 && size > std::numeric_limits<size_t>::max() / copies
+                 ? std::numeric_limits<size_t>::max()
+                 : size * copies;
+    }
+    return size == std::numeric_limits<size_t>::max() ? size : size + 1;
+  }
+
+  // the bytes of a literal or a class
+  std::array<bool, 256> bytesOf(int index) const {
+    const AstNode &node = this->nodes[index];
+    std::array<bool, 256> bytes = {};
+    if (node.kind == AstKind::Literal) {
+      bytes[node.byte] = true;
+    }
+    for (int i = 0; i < node.rangeCount; i++) {
+      ByteRange range = this->getRange(node, i);
+      for (int byte = range.from; byte <= range.to; byte++) {
+        bytes[byte] = true;
+      }
+    }
+    return bytes;
+  }
+
+  bool isSingleByte(int index) const {
+    AstKind kind = this->nodes[index].kind;
+    return kind == AstKind::Literal || kind == AstKind::Class;
+  }
+
+  bool equal(int x, int y) const {
+    const AstNode &a = this->nodes[x];
+    const AstNode &b = this->nodes[y];
+    if (a.kind != b.kind || a.byte != b.byte || a.childCount != b.childCount ||
+        a.rangeCount != b.rangeCount || a.minCount != b.minCount ||
+        a.maxCount != b.maxCount || a.group != b.group) {
+      return false;
+    }
+    for (int i = 0; i < a.rangeCount; i++) {
+      if (!(this->getRange(a, i) == this->getRange(b, i))) {
+        return false;
+      }
+    }
+    for (int i = 0; i < a.childCount; i++) {
+      if (!this->equal(this->getChild(a, i), this->getChild(b, i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // the operands of a concatenation, the node itself for anything else
+  std::vector<int> factorsOf(int index) const {
+    const AstNode &node = this->nodes[index];
+    if (node.kind != AstKind::Concatenation) {
+      return {index};
+    }
+    return std::vector<int>(this->children.begin() + node.firstChild,
+                            this->children.begin() + node.firstChild +
+                                node.childCount);
+  }
+
+  // operands in a row, nested concatenations flattened and empty ones left
+  // out
+  int concatenate(const std::vector<int> &operands) {
+    std::vector<int> flat;
+    for (int operand : operands) {
+      AstKind kind = this->nodes[operand].kind;
+      if (kind == AstKind::Empty) {
+        continue;
+      }
+      if (kind == AstKind::Concatenation) {
+        std::vector<int> factors = this->factorsOf(operand);
+        flat.insert(flat.end(), factors.begin(), factors.end());
+      } else {
+        flat.push_back(operand);
+      }
+    }
+    if (flat.empty()) {
+      return this->addNode(AstKind::Empty, 0, {});
+    }
+    if (flat.size() == 1) {
+      return flat[0];
+    }
+    return this->addNode(AstKind::Concatenation, 0, flat);
+  }
+
+  /*
+   * An alternation of branches with the same leftmost-first matches: nested
+   * alternations are flattened, a branch equal to an earlier one can never
+   * win and is dropped, neighbouring branches starting with the same
+   * literals have them factored out (ab|ac is a(b|c)) and neighbouring
+   * single bytes become one class. Only neighbours are combined so no
+   * branch ever moves ahead of another one.
+   */
+  int alternate(const std::vector<int> &operands) {
+    std::vector<int> branches;
+    // earlier branches by their printed form, only those can be equal
+    std::unordered_map<std::string, std::vector<int>> printed;
+    for (int operand : operands) {
+      const AstNode &node = this->nodes[operand];
+      std::vector<int> nested = {operand};
+      if (node.kind == AstKind::Alternation) {
+        nested.assign(this->children.begin() + node.firstChild,
+                      this->children.begin() + node.firstChild +
+                          node.childCount);
+      }
+      for (int branch : nested) {
+        std::string key;
+        this->appendString(branch, key);
+        std::vector<int> &sameKey = printed[key];
+        bool seen = false;
+        for (int earlier : sameKey) {
+          seen = seen || this->equal(earlier, branch);
+        }
+        if (!seen) {
+          sameKey.push_back(branch);
+          branches.push_back(branch);
+        }
+      }
+    }
+
+    std::vector<int> factored;
+    for (size_t first = 0; first < branches.size();) {
+      std::vector<int> head = this->factorsOf(branches[first]);
+      size_t last = first + 1;
+      // literals all of branches[first, last) start with
+      size_t common = 0;
+      while (common < head.size() &&
+             this->nodes[head[common]].kind == AstKind::Literal) {
+        common++;
+      }
+      while (common > 0 && last < branches.size()) {
+        std::vector<int> next = this->factorsOf(branches[last]);
+        size_t shared = 0;
+        while (shared < common && shared < next.size() &&
+               this->equal(next[shared], head[shared])) {
+          shared++;
+        }
+        if (shared == 0) {
+          break;
+        }
+        common = shared;
+        last++;
+      }
+      if (last == first + 1) {
+        factored.push_back(branches[first]);
+        first = last;
+        continue;
+      }
+
+      std::vector<int> rests;
+      for (size_t i = first; i < last; i++) {
+        std::vector<int> factors = this->factorsOf(branches[i]);
+        rests.push_back(this->concatenate(
+            std::vector<int>(factors.begin() + common, factors.end())));
+      }
+      std::vector<int> prefix(head.begin(), head.begin() + common);
+      prefix.push_back(this->alternate(rests));
+      factored.push_back(this->concatenate(prefix));
+      first = last;
+    }
+
+    std::vector<int> merged;
+    for (size_t first = 0; first < factored.size();) {
+      size_t last = first + 1;
+      if (this->isSingleByte(factored[first])) {
+        std::array<bool, 256> bytes = this->bytesOf(factored[first]);
+        while (last < factored.size() && this->isSingleByte(factored[last])) {
+          std::array<bool, 256> more = this->bytesOf(factored[last]);
+          for (int byte = 0; byte < 256; byte++) {
+            bytes[byte] = bytes[byte] || more[byte];
+          }
+          last++;
+        }
+        merged.push_back(last == first + 1 ? factored[first]
+                                           : this->addClass(bytes));
+      } else {
+        merged.push_back(factored[first]);
+      }
+      first = last;
+    }
+
+    if (merged.size() == 1) {
+      return merged[0];
+    }
+    return this->addNode(AstKind::Alternation, 0, merged);
+  }
+
+  // index of from simplified into this tree
+  int simplifyNode(const RegexAst &from, int index, bool keepGroups) {
+    const AstNode &node = from.nodes[index];
+    std::vector<int> operands;
+    for (int i = 0; i < node.childCount; i++) {
+      operands.push_back(
+          this->simplifyNode(from, from.getChild(node, i), keepGroups));
+    }
+
+    switch (node.kind) {
+    case AstKind::Empty:
+    case AstKind::Literal:
+      return this->addNode(node.kind, node.byte, {});
+    case AstKind::Class:
+      return this->addClass(from.bytesOf(index));
+    case AstKind::Concatenation:
+      return this->concatenate(operands);
+    case AstKind::Alternation:
+      return this->alternate(operands);
+    case AstKind::Star: {
+      // (x*)* and the star of nothing
+      AstKind kind = this->nodes[operands[0]].kind;
+      if (kind == AstKind::Star || kind == AstKind::Empty) {
+        return operands[0];
+      }
+      return this->addNode(AstKind::Star, 0, operands);
+    }
+    case AstKind::Repeat: {
+      if (node.maxCount == 0 ||
+          this->nodes[operands[0]].kind == AstKind::Empty) {
+        return this->addNode(AstKind::Empty, 0, {});
+      }
+      int repeat = this->addNode(AstKind::Repeat, 0, operands);
+      this->nodes[repeat].minCount = node.minCount;
+      this->nodes[repeat].maxCount = node.maxCount;
+      return repeat;
+    }
+    case AstKind::Group: {
+      if (!keepGroups) {
+        return operands[0];
+      }
+      int group = this->addNode(AstKind::Group, 0, operands);
+      this->nodes[group].group = node.group;
+      return group;
+    }
+    }
+    return operands[0];
+  }
+
+public:
+  RegexAst() {}
+
+  // throws std::invalid_argument when pattern is not a valid regex
+  static RegexAst parse(std::string_view pattern) {
+    RegexAst ast;
+    ast.pattern = pattern;
+    ast.nodes.reserve(pattern.size() + 1);
+    ast.children.reserve(pattern.size());
+    ast.root = ast.parseAlternation();
+    if (!ast.atEnd()) {
+      ast.fail("unbalanced )");
+    }
+    ast.pattern = std::string_view();
+    return ast;
+  }
+
+  int getRoot() const { return this->root; }
+
+  const AstNode &getNode(int index) const { return this->nodes[index]; }
+
+  int getChild(const AstNode &node, int i) const {
+    return this->children[node.firstChild + i];
+  }
+
+  ByteRange getRange(const AstNode &node, int i) const {
+    return this->ranges[node.firstRange + i];
+  }
+
+  int getGroupCount() const { return this->groupCount; }
+
+  // the node inside any capture groups wrapped around index
+  int unwrapGroups(int index) const {
+    while (this->nodes[index].kind == AstKind::Group) {
+      index = this->getChild(this->nodes[index], 0);
+    }
+    return index;
+  }
+
+  size_t size() const { return this->nodes.size(); }
+
+  // the number of nodes once every repeat is replaced by copies of its
+  // operand, saturating instead of overflowing
+  size_t getExpandedSize() const { return this->expandedSize(this->root); }
+
+  /*
+   * The same pattern with fewer nodes, matching the same spans in a
+   * leftmost-first search: concatenations and alternations are flattened,
+   * empty operands of concatenations and repeats of nothing dropped, (x*)*
+   * is x* and alternations are simplified as described at alternate.
+   * Without keepGroups the groups are left out as well, which is all the
+   * automata that only match need, the result then has no groups.
+   */
+  RegexAst simplify(bool keepGroups = true) const {
+    RegexAst simplified;
+    simplified.nodes.reserve(this->nodes.size());
+    simplified.groupCount = keepGroups ? this->groupCount : 0;
+    simplified.root = simplified.simplifyNode(*this, this->root, keepGroups);
+    return simplified;
+  }
+
+  // fully parenthesized form, classes as their ranges, bytes outside the
+  // printable range in hex and groups followed by their number
+  std::string toString() const {
+    std::string out;
+    this->appendString(this->root, out);
+    return out;
+  }
+};
+
+// true when the automaton of index starts with a byte edge
+inline bool startsWithByte(const RegexAst &ast, int index) {
+  const AstNode &node = ast.getNode(index);
+  if (node.kind == AstKind::Concatenation) {
+    return startsWithByte(ast, ast.getChild(node, 0));
+  }
+  return node.kind == AstKind::Literal || node.kind == AstKind::Class;
+}
+
+class CountingNfa;
+class PikeVm;
+
+/*
+ * Thompson construction working from node indices. Every node is built
+ * between a from and a to state it is handed: it only adds edges leaving
+ * from and entering to, everything in between is fresh states. That is what
+ * lets the operands of an alternation share both ends. A star goes through a
+ * fresh loop state so that looping never leads back into a sibling of the
+ * star, and its loop edge is added before its exit edge so searches prefer
+ * another iteration (greedy).
+ *
+ * A repeat is written out: minCount copies of its operand, then a star for
+ * an open upper bound or one optional copy per missing count, each of which
+ * can skip straight to the end. Built into a CountingNfa, a repeat of a
+ * single byte or class becomes a counter instead.
+ */
+template <typename Automaton>
+void buildNfaBetween(const RegexAst &ast, int index, Automaton &nfa, int from,
+                     int to) {
+  const AstNode &node = ast.getNode(index);
+  switch (node.kind) {
+  case AstKind::Empty:
+    nfa.addEpsilonTransition(from, to);
+    return;
+  case AstKind::Literal:
+    nfa.addRangeTransition(from, ByteRange{node.byte, node.byte}, to);
+    return;
+  case AstKind::Class:
+    // an empty class gets no edge at all and never matches
+    for (int i = 0; i < node.rangeCount; i++) {
+      nfa.addRangeTransition(from, ast.getRange(node, i), to);
+    }
+    return;
+  case AstKind::Concatenation: {
+    int current = from;
+    for (int i = 0; i < node.childCount; i++) {
+      int next = i + 1 == node.childCount ? to : nfa.createNewState();
+      buildNfaBetween(ast, ast.getChild(node, i), nfa, current, next);
+      current = next;
+    }
+    return;
+  }
+  case AstKind::Alternation: {
+    // the byte edges of a state come before anything reached over its
+    // epsilon edges, so once a branch may start with an epsilon edge every
+    // branch gets a state of its own to keep them in order
+    bool ordered = true;
+    for (int i = 0; i < node.childCount; i++) {
+      ordered = ordered && startsWithByte(ast, ast.getChild(node, i));
+    }
+    for (int i = 0; i < node.childCount; i++) {
+      int start = from;
+      if (!ordered) {
+        start = nfa.createNewState();
+        nfa.addEpsilonTransition(from, start);
+      }
+      buildNfaBetween(ast, ast.getChild(node, i), nfa, start, to);
+    }
+    return;
+  }
+  case AstKind::Star: {
+    int loop = nfa.createNewState();
+    int body = nfa.createNewState();
+    nfa.addEpsilonTransition(from, loop);
+    buildNfaBetween(ast, ast.getChild(node, 0), nfa, loop, body);
+    nfa.addEpsilonTransition(body, loop);
+    nfa.addEpsilonTransition(loop, to);
+    return;
+  }
+  case AstKind::Repeat: {
+    int child = ast.getChild(node, 0);
+    if constexpr (std::is_same_v<Automaton, CountingNfa>) {
+      AstKind kind = ast.getNode(ast.unwrapGroups(child)).kind;
+      if (kind == AstKind::Literal || kind == AstKind::Class) {
+        nfa.addCounter(from, to, ast, index);
+        return;
+      }
+    }
+    if (node.maxCount == 0) {
+      nfa.addEpsilonTransition(from, to);
+      return;
+    }
+    bool optional = node.maxCount != node.minCount;
+    int current = from;
+    for (int i = 0; i < node.minCount; i++) {
+      int next =
+          i + 1 == node.minCount && !optional ? to : nfa.createNewState();
+      buildNfaBetween(ast, child, nfa, current, next);
+      current = next;
+    }
+    if (node.maxCount == -1) {
+      int loop = nfa.createNewState();
+      int body = nfa.createNewState();
+      nfa.addEpsilonTransition(current, loop);
+      buildNfaBetween(ast, child, nfa, loop, body);
+      nfa.addEpsilonTransition(body, loop);
+      nfa.addEpsilonTransition(loop, to);
+      return;
+    }
+    for (int i = node.minCount; i < node.maxCount; i++) {
+      int next = i + 1 == node.maxCount ? to : nfa.createNewState();
+      buildNfaBetween(ast, child, nfa, current, next);
+      nfa.addEpsilonTransition(current, to);
+      current = next;
+    }
+    return;
+  }
+  case AstKind::Group: {
+    int child = ast.getChild(node, 0);
+    if constexpr (std::is_same_v<Automaton, PikeVm>) {
+      // entering these two states records where the group starts and ends
+      int open = nfa.createSaveState(2 * node.group);
+      int close = nfa.createSaveState(2 * node.group + 1);
+      nfa.addEpsilonTransition(from, open);
+      buildNfaBetween(ast, child, nfa, open, close);
+      nfa.addEpsilonTransition(close, to);
+      return;
+    }
+    buildNfaBetween(ast, child, nfa, from, to);
+    return;
+  }
+  }
+}
+
+/*
+ * The frozen NFA of a parsed pattern. Throws std::invalid_argument when its
+ * repeats written out have more than RegexAst::maxExpandedSize nodes, those
+ * patterns need a CountingNfa.
+ */
+inline std::unique_ptr<Nfa> buildNfa(const RegexAst &ast) {
+  if (ast.getExpandedSize() > RegexAst::maxExpandedSize) {
+    throw std::invalid_argument("Invalid regex: repetitions too large to "
+                                "write out");
+  }
+
+  std::unique_ptr<Nfa> nfa = std::make_unique<Nfa>();
+  int start = nfa->createNewState();
+  int end = nfa->createNewState();
+  nfa->addFinalState(end);
+  buildNfaBetween(ast, ast.getRoot(), *nfa, start, end);
+
+  if (traceCompilation) {
+    std::cout << "AST: " << ast.toString() << std::endl;
+    nfa->print();
+  }
+
+  nfa->freeze();
+  return nfa;
+}
+
+/*
+ * Thompson automaton in which every repeat of a single byte or class is a
+ * counter, for patterns like [0-9]{1,100000} that would not fit in memory
+ * written out. A counter is one state, and the simulation keeps the set of
+ * counts reached by the threads in it. Reading a byte of the class moves
+ * every count up by one at once, so the set is a queue of the positions
+ * the counts started at, oldest first: counting up is free, counts past
+ * the maximum are popped from the front, and without a maximum every count
+ * past the minimum is the same and only the newest of them is kept. A
+ * thread leaves the counter as soon as some count is within the bounds.
+ *
+ * Compiled size is one state per counter whatever its bounds, a queue never
+ * holds more than the larger bound plus one entry, and a step costs the
+ * active states plus the entries it pops. Repeats of longer operands are
+ * still written out, with counters inside them.
+ */
+class CountingNfa {
+private:
+  struct Counter {
+    std::array<bool, 256> bytes = {};
+    int minCount = 0;
+    int maxCount = 0;
+    // entered once a count is within the bounds
+    int exit = 0;
+  };
+
+  std::vector<std::vector<std::pair<ByteRange, int>>> edges;
+  std::vector<std::vector<int>> epsilons;
+  // counter owning each state, -1 for plain states
+  std::vector<int> counterOf;
+  std::vector<Counter> counters;
+
+  // adds state at position, a counter starts a new count there
+  void enter(int state, size_t position, SparseSet &states,
+             std::vector<std::deque<size_t>> &starts) const {
+    int counter = this->counterOf[state];
+    if (counter != -1) {
+      std::deque<size_t> &queue = starts[counter];
+      if (queue.empty() || queue.back() != position) {
+        queue.push_back(position);
+      }
+    }
+    states.insert(state);
+  }
+
+  // follows epsilon edges and counter exits from every state of states
+  void addClosure(SparseSet &states, size_t position,
+                  std::vector<std::deque<size_t>> &starts) const {
+    for (int i = 0; i < states.size(); i++) {
+      int state = states[i];
+      for (int next : this->epsilons[state]) {
+        this->enter(next, position, states, starts);
+      }
+      int counter = this->counterOf[state];
+      if (counter != -1 &&
+          position - starts[counter].front() >=
+              size_t(this->counters[counter].minCount)) {
+        this->enter(this->counters[counter].exit, position, states, starts);
+      }
+    }
+  }
+
+  void step(const SparseSet &current, unsigned char c, size_t position,
+            SparseSet &next, std::vector<std::deque<size_t>> &starts) const {
+    next.clear();
+    for (int state : current) {
+      int counter = this->counterOf[state];
+      if (counter == -1) {
+        for (const std::pair<ByteRange, int> &edge : this->edges[state]) {
+          if (edge.first.contains(c)) {
+            this->enter(edge.second, position, next, starts);
+          }
+        }
+        continue;
+      }
+
+      const Counter &bounds = this->counters[counter];
+      std::deque<size_t> &queue = starts[counter];
+      if (!bounds.bytes[c]) {
+        queue.clear();
+        continue;
+      }
+      if (bounds.maxCount != -1) {
+        while (!queue.empty() &&
+               position - queue.front() > size_t(bounds.maxCount)) {
+          queue.pop_front();
+        }
+      } else {
+        while (queue.size() >= 2 &&
+               position - queue[1] >= size_t(bounds.minCount)) {
+          queue.pop_front();
+        }
+      }
+      if (!queue.empty()) {
+        next.insert(state);
+      }
+    }
+  }
+
+  // whole input when anywhere is false, otherwise any part of it
+  bool simulate(std::string_view input, bool anywhere) const {
+    int stateCount = this->edges.size();
+    SparseSet current(stateCount);
+    SparseSet next(stateCount);
+    std::vector<std::deque<size_t>> starts(this->counters.size());
+
+    this->enter(startState, 0, current, starts);
+    this->addClosure(current, 0, starts);
+    for (size_t position = 0; position < input.size(); position++) {
+      if (anywhere && current.contains(finalState)) {
+        return true;
+      }
+      if (current.empty() && !anywhere) {
+        return false;
+      }
+      this->step(current, input[position], position + 1, next, starts);
+      std::swap(current, next);
+      if (anywhere) {
+        this->enter(startState, position + 1, current, starts);
+      }
+      this->addClosure(current, position + 1, starts);
+    }
+    return current.contains(finalState);
+  }
+
+public:
+  static constexpr int startState = 0;
+  static constexpr int finalState = 1;
+
+  CountingNfa() {}
+
+  /*
+   * Throws std::invalid_argument when the automaton would still have more
+   * than RegexAst::maxExpandedSize states, which takes repeats of repeats
+   * that are not single bytes.
+   */
+  static std::unique_ptr<CountingNfa> fromAst(const RegexAst &ast) {
+    std::unique_ptr<CountingNfa> nfa = std::make_unique<CountingNfa>();
+    int start = nfa->createNewState();
+    int end = nfa->createNewState();
+    buildNfaBetween(ast, ast.getRoot(), *nfa, start, end);
+    return nfa;
+  }
+
+  int createNewState() {
+    if (this->edges.size() == RegexAst::maxExpandedSize) {
+      throw std::invalid_argument("Invalid regex: repetitions too large to "
+                                  "write out");
+    }
+    this->edges.emplace_back();
+    this->epsilons.emplace_back();
+    this->counterOf.push_back(-1);
+    return this->edges.size() - 1;
+  }
+
+  void addRangeTransition(int fromState, ByteRange range, int toState) {
+    this->edges[fromState].push_back(std::make_pair(range, toState));
+  }
+
+  void addEpsilonTransition(int fromState, int toState) {
+    this->epsilons[fromState].push_back(toState);
+  }
+
+  // a counter between from and to for the repeat at index, whose operand is
+  // a literal or a class
+  void addCounter(int fromState, int toState, const RegexAst &ast,
+                  int index) {
+    const AstNode &repeat = ast.getNode(index);
+    const AstNode &operand =
+        ast.getNode(ast.unwrapGroups(ast.getChild(repeat, 0)));
+    Counter counter;
+    counter.minCount = repeat.minCount;
+    counter.maxCount = repeat.maxCount;
+    counter.exit = toState;
+    if (operand.kind == AstKind::Literal) {
+      counter.bytes[operand.byte] = true;
+    }
+    for (int i = 0; i < operand.rangeCount; i++) {
+      ByteRange range = ast.getRange(operand, i);
+      for (int byte = range.from; byte <= range.to; byte++) {
+        counter.bytes[byte] = true;
+      }
+    }
+
+    int state = this->createNewState();
+    this->counterOf[state] = this->counters.size();
+    this->counters.push_back(counter);
+    this->addEpsilonTransition(fromState, state);
+  }
+
+  int getStateCount() const { return this->edges.size(); }
+
+  int getCounterCount() const { return this->counters.size(); }
+
+  // bytes held by the automaton, the queues of a simulation come on top
+  size_t getMemoryUsed() const {
+    size_t used = sizeof(CountingNfa) +
+                  (sizeof(this->edges[0]) + sizeof(this->epsilons[0]) +
+                   sizeof(int)) *
+                      this->edges.size() +
+                  sizeof(Counter) * this->counters.size();
+    for (size_t state = 0; state < this->edges.size(); state++) {
+      used += sizeof(std::pair<ByteRange, int>) * this->edges[state].size() +
+              sizeof(int) * this->epsilons[state].size();
+    }
+    return used;
+  }
+
+  // true when the whole input matches
+  bool runSimulation(std::string_view input) const {
+    return this->simulate(input, false);
+  }
+
+  // true when some part of the input matches
+  bool contains(std::string_view input) const {
+    return this->simulate(input, true);
+  }
+};
+
+/*
+ * Pike VM: the Thompson simulation of Nfa::search where every thread also
+ * carries the positions at which the capture groups on its path started and
+ * ended. Those positions live in slots, 2 * i and 2 * i + 1 for group i and
+ * slots 0 and 1 for the whole match, and are recorded by save states that
+ * sit around every group. Threads are kept in priority order like in
+ * Nfa::search and the first thread to reach a state owns it, so the slots
+ * are the ones a backtracking engine would report, in time linear in the
+ * input and the size of the pattern.
+ */
+class PikeVm {
+private:
+  std::vector<std::vector<std::pair<ByteRange, int>>> edges;
+  std::vector<std::vector<int>> epsilons;
+  // slot every state saves the position in when entered, -1 for most
+  std::vector<int> saves;
+  int groupCount = 0;
+
+  struct Threads {
+    SparseSet states;
+    // slotCount slots for every state in states
+    std::vector<size_t> slots;
+
+    Threads(int stateCount, int slotCount)
+        : states(stateCount), slots(size_t(stateCount) * slotCount) {}
+  };
+
+  int getSlotCount() const { return 2 * (this->groupCount + 1); }
+
+  // adds the thread entering state at position with slots, and everything it
+  // reaches over epsilon edges, behind the threads already there. Frames
+  // with a negative state put back the slot a save state overwrote once
+  // everything behind it has been added
+  void addThread(Threads &threads, int state, size_t position,
+                 std::vector<size_t> &slots,
+                 std::vector<std::pair<int, size_t>> &stack) const {
+    int slotCount = this->getSlotCount();
+    stack.clear();
+    stack.push_back(std::make_pair(state, 0));
+    while (!stack.empty()) {
+      std::pair<int, size_t> frame = stack.back();
+      stack.pop_back();
+      if (frame.first < 0) {
+        slots[-frame.first - 1] = frame.second;
+        continue;
+      }
+      int current = frame.first;
+      if (!threads.states.insert(current)) {
+        continue;
+      }
+
+      int slot = this->saves[current];
+      if (slot != -1) {
+        stack.push_back(std::make_pair(-slot - 1, slots[slot]));
+        slots[slot] = position;
+      }
+      if (current == finalState || !this->edges[current].empty()) {
+        std::copy(slots.begin(), slots.end(),
+                  threads.slots.begin() + size_t(current) * slotCount);
+      }
+      for (auto next = this->epsilons[current].rbegin();
+           next != this->epsilons[current].rend(); next++) {
+        if (!threads.states.contains(*next)) {
+          stack.push_back(std::make_pair(*next, 0));
+        }
+      }
+    }
+  }
+
+  // search from from on, or the match of exactly input[from, end) when
+  // anchored is set, the slots of the match end up in groups
+  bool run(std::string_view input, size_t from, bool anchored,
+           std::vector<Match> &groups) const {
+    int stateCount = this->edges.size();
+    int slotCount = this->getSlotCount();
+    Threads current(stateCount, slotCount);
+    Threads next(stateCount, slotCount);
+    std::vector<size_t> slots(slotCount);
+    std::vector<size_t> matchSlots;
+    std::vector<std::pair<int, size_t>> stack;
+    bool matched = false;
+
+    for (size_t position = from; position <= input.size(); position++) {
+      if (!matched && (!anchored || position == from)) {
+        std::fill(slots.begin(), slots.end(), std::string_view::npos);
+        slots[0] = position;
+        this->addThread(current, startState, position, slots, stack);
+      }
+
+      if (!anchored || position == input.size()) {
+        int kept = 0;
+        for (int state : current.states) {
+          kept++;
+          if (state == finalState) {
+            auto first = current.slots.begin() + size_t(state) * slotCount;
+            matchSlots.assign(first, first + slotCount);
+            matchSlots[1] = position;
+            matched = true;
+            current.states.truncate(kept);
+            break;
+          }
+        }
+      }
+
+      if (position == input.size() ||
+          ((matched || anchored) && current.states.empty())) {
+        break;
+      }
+
+      next.states.clear();
+      unsigned char symbol = static_cast<unsigned char>(input[position]);
+      for (int state : current.states) {
+        for (const std::pair<ByteRange, int> &edge : this->edges[state]) {
+          if (!edge.first.contains(symbol)) {
+            continue;
+          }
+          auto first = current.slots.begin() + size_t(state) * slotCount;
+          slots.assign(first, first + slotCount);
+          this->addThread(next, edge.second, position + 1, slots, stack);
+        }
+      }
+      std::swap(current, next);
+    }
+
+    if (!matched) {
+      return false;
+    }
+    groups.resize(this->groupCount + 1);
+    for (int group = 0; group <= this->groupCount; group++) {
+      groups[group].start = matchSlots[2 * group];
+      groups[group].end = matchSlots[2 * group + 1];
+    }
+    return true;
+  }
+
+public:
+  static constexpr int startState = 0;
+  static constexpr int finalState = 1;
+
+  PikeVm() {}
+
+  static std::unique_ptr<PikeVm> fromAst(const RegexAst &ast) {
+    if (ast.getExpandedSize() > RegexAst::maxExpandedSize) {
+      throw std::invalid_argument("Invalid regex: repetitions too large to "
+                                  "write out");
+    }
+    std::unique_ptr<PikeVm> vm = std::make_unique<PikeVm>();
+    vm->groupCount = ast.getGroupCount();
+    int start = vm->createNewState();
+    int end = vm->createNewState();
+    buildNfaBetween(ast, ast.getRoot(), *vm, start, end);
+    return vm;
+  }
+
+  int createNewState() {
+    this->edges.emplace_back();
+    this->epsilons.emplace_back();
+    this->saves.push_back(-1);
+    return this->edges.size() - 1;
+  }
+
+  int createSaveState(int slot) {
+    int state = this->createNewState();
+    this->saves[state] = slot;
+    return state;
+  }
+
+  void addRangeTransition(int fromState, ByteRange range, int toState) {
+    this->edges[fromState].push_back(std::make_pair(range, toState));
+  }
+
+  void addEpsilonTransition(int fromState, int toState) {
+    this->epsilons[fromState].push_back(toState);
+  }
+
+  int getStateCount() const { return this->edges.size(); }
+
+  int getGroupCount() const { return this->groupCount; }
+
+  const std::vector<std::pair<ByteRange, int>> &getEdges(int state) const {
+    return this->edges[state];
+  }
+
+  const std::vector<int> &getEpsilons(int state) const {
+    return this->epsilons[state];
+  }
+
+  int getSave(int state) const { return this->saves[state]; }
+
+  size_t getMemoryUsed() const {
+    size_t used = sizeof(PikeVm) + sizeof(int) * this->saves.size();
+    for (size_t state = 0; state < this->edges.size(); state++) {
+      used += sizeof(this->edges[state]) + sizeof(this->epsilons[state]) +
+              sizeof(std::pair<ByteRange, int>) * this->edges[state].size() +
+              sizeof(int) * this->epsilons[state].size();
+    }
+    return used;
+  }
+
+  /*
+   * The leftmost-first match starting at or after from. groups[0] is the
+   * match and groups[i] where group i matched in it, the last iteration
+   * when it is repeated, both ends npos when it did not take part.
+   */
+  bool search(std::string_view input, size_t from,
+              std::vector<Match> &groups) const {
+    return this->run(input, from, false, groups);
+  }
+
+  // the same for a match of the whole input
+  bool fullMatch(std::string_view input, std::vector<Match> &groups) const {
+    return this->run(input, 0, true, groups);
+  }
+};
+
+/*
+ * DFA for the full matches of a pattern whose groups can be tracked without
+ * running threads: a pattern is one-pass when, wherever a match is, the next
+ * byte decides which way it goes on, like (\d*)-(\d*). Every state is a
+ * state of the PikeVm that a byte edge leads to, and every transition knows
+ * which slots the save states it passes through set. Matching is one table
+ * lookup per byte with no slots to copy.
+ *
+ * fromPikeVm gives up as soon as two ways through the epsilon edges lead to
+ * the same byte or to the end of a match, and for patterns with more than
+ * maxGroups groups, which would not fit the slots of a transition in a word.
+ */
+class OnePassDfa {
+public:
+  static constexpr int maxGroups = 31;
+  static constexpr int maxStates = 10000;
+
+private:
+  struct Transition {
+    // -1 when there is none
+    int target = -1;
+    // slots set to the position of the byte, bit i for slot i
+    uint64_t saves = 0;
+  };
+
+  ByteClasses byteClasses;
+  std::vector<Transition> transitions;
+  std::vector<char> acceptingStates;
+  // slots set to the end of the input when a match ends in a state
+  std::vector<uint64_t> acceptSaves;
+  int stride = 1;
+  int groupCount = 0;
+
+  static void save(uint64_t saves, size_t position,
+                   std::array<size_t, 64> &slots) {
+    while (saves != 0) {
+      slots[__builtin_ctzll(saves)] = position;
+      saves &= saves - 1;
+    }
+  }
+
+public:
+  OnePassDfa() {}
+
+  // nullptr when the pattern is not one-pass
+  static std::unique_ptr<OnePassDfa> fromPikeVm(const PikeVm &vm) {
+    if (vm.getGroupCount() > maxGroups) {
+      return nullptr;
+    }
+    std::unique_ptr<OnePassDfa> dfa = std::make_unique<OnePassDfa>();
+    dfa->groupCount = vm.getGroupCount();
+    for (int state = 0; state < vm.getStateCount(); state++) {
+      for (const std::pair<ByteRange, int> &edge : vm.getEdges(state)) {
+        dfa->byteClasses.split(edge.first.from, edge.first.to);
+      }
+    }
+    dfa->stride = dfa->byteClasses.size();
+
+    // PikeVm state behind every DFA state, which doubles as the work list
+    std::vector<int> vmStates = {PikeVm::startState};
+    std::vector<int> stateOf(vm.getStateCount(), -1);
+    stateOf[PikeVm::startState] = 0;
+
+    SparseSet reached(vm.getStateCount());
+    std::vector<uint64_t> reachedSaves(vm.getStateCount());
+    std::vector<std::pair<int, uint64_t>> stack;
+    for (size_t state = 0; state < vmStates.size(); state++) {
+      if (state == size_t(maxStates)) {
+        return nullptr;
+      }
+      size_t row = dfa->transitions.size();
+      dfa->transitions.resize(row + dfa->stride);
+      dfa->acceptingStates.push_back(false);
+      dfa->acceptSaves.push_back(0);
+
+      reached.clear();
+      stack.push_back(std::make_pair(vmStates[state], 0));
+      while (!stack.empty()) {
+        auto [current, saves] = stack.back();
+        stack.pop_back();
+        if (!reached.insert(current)) {
+          // a second way to the same state only matters if it saves
+          // different slots
+          if (reachedSaves[current] != saves) {
+            return nullptr;
+          }
+          continue;
+        }
+        reachedSaves[current] = saves;
+        if (vm.getSave(current) != -1) {
+          saves |= uint64_t(1) << vm.getSave(current);
+        }
+
+        if (current == PikeVm::finalState) {
+          dfa->acceptingStates[state] = true;
+          dfa->acceptSaves[state] = saves;
+        }
+        for (const std::pair<ByteRange, int> &edge : vm.getEdges(current)) {
+          if (stateOf[edge.second] == -1) {
+            stateOf[edge.second] = vmStates.size();
+            vmStates.push_back(edge.second);
+          }
+          Transition transition{stateOf[edge.second], saves};
+          for (int byte = edge.first.from; byte <= edge.first.to; byte++) {
+            Transition &cell =
+                dfa->transitions[row + dfa->byteClasses.get(byte)];
+            if (cell.target == -1) {
+              cell = transition;
+            } else if (cell.target != transition.target ||
+                       cell.saves != transition.saves) {
+              return nullptr;
+            }
+          }
+        }
+        for (int next : vm.getEpsilons(current)) {
+          stack.push_back(std::make_pair(next, saves));
+        }
+      }
+    }
+
+    return dfa;
+  }
+
+  int getStateCount() const { return this->acceptingStates.size(); }
+
+  size_t getMemoryUsed() const {
+    return sizeof(OnePassDfa) +
+           sizeof(Transition) * this->transitions.size() +
+           this->acceptingStates.size() +
+           sizeof(uint64_t) * this->acceptSaves.size();
+  }
+
+  // PikeVm::fullMatch in one table lookup per byte
+  bool fullMatch(std::string_view input, std::vector<Match> &groups) const {
+    std::array<size_t, 64> slots;
+    slots.fill(std::string_view::npos);
+    slots[0] = 0;
+    const unsigned char *classes = this->byteClasses.data();
+    int state = 0;
+    for (size_t position = 0; position < input.size(); position++) {
+      const Transition &transition =
+          this->transitions[state * this->stride +
+                            classes[static_cast<unsigned char>(
+                                input[position])]];
+      if (transition.target == -1) {
+        return false;
+      }
+      save(transition.saves, position, slots);
+      state = transition.target;
+    }
+    if (!this->acceptingStates[state]) {
+      return false;
+    }
+    save(this->acceptSaves[state], input.size(), slots);
+    slots[1] = input.size();
+
+    groups.resize(this->groupCount + 1);
+    for (int group = 0; group <= this->groupCount; group++) {
+      groups[group].start = slots[2 * group];
+      groups[group].end = slots[2 * group + 1];
+    }
+    return true;
+  }
+};
+
+/*
+ * Glushkov automaton of a small pattern, simulated bit-parallel. Every
+ * literal or class of the pattern is a position and the automaton is in
+ * position p right after reading a byte of p, so there are no epsilon moves
+ * and the set of active positions fits a machine word. Bit 0 is the position
+ * before any input, bits 1 to maxPositions the literals and classes.
+ *
+ * A step maps the active set to the union of the positions that can follow
+ * them and keeps those that accept the next byte. The union is looked
+ * up a byte of the set at a time: followTables[k][b] is what follows the
+ * positions 8k to 8k + 7 set in b. That is one table load per 8 positions
+ * plus the byte mask, a few cycles per byte without building any DFA.
+ */
+class GlushkovNfa {
+private:
+  // what can come right after a fragment and what it starts and ends with
+  struct Fragment {
+    uint64_t first = 0;
+    uint64_t last = 0;
+    bool nullable = false;
+  };
+
+  std::array<uint64_t, 256> byteMasks = {};
+  std::vector<std::array<uint64_t, 256>> followTables;
+  uint64_t acceptMask = 0;
+  int positionCount = 0;
+
+public:
+  static constexpr int maxPositions = 63;
+
+private:
+  static void addFollow(std::array<uint64_t, maxPositions + 1> &follow,
+                        uint64_t from, uint64_t to) {
+    for (int position = 0; position <= maxPositions; position++) {
+      if ((from >> position) & 1) {
+        follow[position] |= to;
+      }
+    }
+  }
+
+  // fragment followed by next
+  static void append(Fragment &fragment, const Fragment &next,
+                     std::array<uint64_t, maxPositions + 1> &follow) {
+    addFollow(follow, fragment.last, next.first);
+    fragment.first =
+        fragment.nullable ? fragment.first | next.first : fragment.first;
+    fragment.last = next.nullable ? fragment.last | next.last : next.last;
+    fragment.nullable = fragment.nullable && next.nullable;
+  }
+
+  // numbers the literals and classes under index and records what follows
+  // what, fits is cleared once there are more than maxPositions of them
+  Fragment build(const RegexAst &ast, int index,
+                 std::array<uint64_t, maxPositions + 1> &follow, bool &fits) {
+    const AstNode &node = ast.getNode(index);
+    Fragment fragment;
+    switch (node.kind) {
+    case AstKind::Empty:
+      fragment.nullable = true;
+      break;
+    case AstKind::Literal:
+    case AstKind::Class: {
+      if (this->positionCount == maxPositions) {
+        fits = false;
+        break;
+      }
+      this->positionCount++;
+      uint64_t position = uint64_t(1) << this->positionCount;
+      if (node.kind == AstKind::Literal) {
+        this->byteMasks[node.byte] |= position;
+      }
+      for (int i = 0; i < node.rangeCount; i++) {
+        ByteRange range = ast.getRange(node, i);
+        for (int byte = range.from; byte <= range.to; byte++) {
+          this->byteMasks[byte] |= position;
+        }
+      }
+      fragment.first = position;
+      fragment.last = position;
+      break;
+    }
+    case AstKind::Concatenation:
+      fragment.nullable = true;
+      for (int i = 0; i < node.childCount && fits; i++) {
+        append(fragment,
+               this->build(ast, ast.getChild(node, i), follow, fits), follow);
+      }
+      break;
+    case AstKind::Alternation:
+      for (int i = 0; i < node.childCount && fits; i++) {
+        Fragment next = this->build(ast, ast.getChild(node, i), follow, fits);
+        fragment.first |= next.first;
+        fragment.last |= next.last;
+        fragment.nullable = fragment.nullable || next.nullable;
+      }
+      break;
+    case AstKind::Star:
+      fragment = this->build(ast, ast.getChild(node, 0), follow, fits);
+      addFollow(follow, fragment.last, fragment.first);
+      fragment.nullable = true;
+      break;
+    case AstKind::Repeat: {
+      // written out as in buildNfaBetween, every copy has its own positions
+      fragment.nullable = true;
+      int copies = node.maxCount == -1 ? node.minCount + 1 : node.maxCount;
+      for (int i = 0; i < copies && fits; i++) {
+        Fragment next = this->build(ast, ast.getChild(node, 0), follow, fits);
+        if (i == node.minCount && node.maxCount == -1) {
+          addFollow(follow, next.last, next.first);
+        }
+        next.nullable = next.nullable || i >= node.minCount;
+        append(fragment, next, follow);
+      }
+      break;
+    }
+    case AstKind::Group:
+      fragment = this->build(ast, ast.getChild(node, 0), follow, fits);
+      break;
+    }
+    return fragment;
+  }
+
+public:
+  GlushkovNfa() {}
+
+  // nullptr when the pattern has more than maxPositions literals and classes
+  static std::unique_ptr<GlushkovNfa> fromAst(const RegexAst &ast) {
+    if (ast.getExpandedSize() > RegexAst::maxExpandedSize) {
+      return nullptr;
+    }
+    std::unique_ptr<GlushkovNfa> glushkov = std::make_unique<GlushkovNfa>();
+    std::array<uint64_t, maxPositions + 1> follow = {};
+    bool fits = true;
+    Fragment root = glushkov->build(ast, ast.getRoot(), follow, fits);
+    if (!fits) {
+      return nullptr;
+    }
+
+    // the position before any input is followed by the start of the pattern
+    follow[0] = root.first;
+    glushkov->acceptMask = root.nullable ? root.last | 1 : root.last;
+
+    int tableCount = (glushkov->positionCount + 1 + 7) / 8;
+    glushkov->followTables.resize(tableCount);
+    for (int table = 0; table < tableCount; table++) {
+      for (int bits = 0; bits < 256; bits++) {
+        uint64_t followers = 0;
+        for (int bit = 0; bit < 8; bit++) {
+          int position = table * 8 + bit;
+          if (((bits >> bit) & 1) && position <= maxPositions) {
+            followers |= follow[position];
+          }
+        }
+        glushkov->followTables[table][bits] = followers;
+      }
+    }
+
+    return glushkov;
+  }
+
+  int getPositionCount() const { return this->positionCount; }
+
+  size_t getMemoryUsed() const {
+    return sizeof(GlushkovNfa) +
+           sizeof(this->byteMasks) * this->followTables.size();
+  }
+
+  bool runSimulation(std::string_view input) const {
+    const std::array<uint64_t, 256> *tables = this->followTables.data();
+    size_t tableCount = this->followTables.size();
+    uint64_t states = 1;
+
+    for (unsigned char c : input) {
+      uint64_t next = 0;
+      for (size_t table = 0; table < tableCount; table++) {
+        next |= tables[table][(states >> (table * 8)) & 0xff];
+      }
+      states = next & this->byteMasks[c];
+      if (states == 0) {
+        return false;
+      }
+    }
+    return (states & this->acceptMask) != 0;
+  }
+};
+
+/*
+ * Aho-Corasick automaton over a list of literals, what a pattern like
+ * word1|word2|...|wordN compiles to instead of an NFA that forks into every
+ * word. It is the trie of the literals where every node also has a failure
+ * link to the node of its longest proper suffix that is in the trie, so a
+ * scan takes one transition per byte no matter how many literals there are.
+ *
+ * Nodes less than denseDepth bytes deep have a full row of transitions with
+ * the failure links already followed, there are few of them and nearly every
+ * byte passes through them. Deeper nodes only keep their trie edges, sorted
+ * by byte, and fall back along their failure links. Whenever the scan is back
+ * at the root it skips ahead to the next byte some literal starts with, with
+ * findAnyByte, as long as the literals start with at most maxPrefilterBytes
+ * different bytes.
+ */
+class AhoCorasick {
+public:
+  static constexpr int denseDepth = 2;
+  static constexpr size_t maxPrefilterBytes = 3;
+
+private:
+  static constexpr int root = 0;
+
+  struct Edge {
+    unsigned char byte;
+    int target;
+  };
+
+  // number of bytes from the root, the length of the literal a node ends
+  std::vector<int> depths;
+  std::vector<int> failures;
+  // the first literal of the list that ends at a node, -1 if none does
+  std::vector<int> literals;
+  // the node itself when it ends a literal, otherwise the nearest node on its
+  // failure chain that does, -1 if there is none
+  std::vector<int> outputs;
+  // row of a dense node in denseRows, -1 for the others
+  std::vector<int> denseIndex;
+  std::vector<int> denseRows;
+  std::vector<int> edgeOffsets;
+  std::vector<Edge> edges;
+  std::string startBytes;
+  size_t literalCount = 0;
+  size_t maxLength = 0;
+
+  int next(int state, unsigned char byte) const {
+    while (this->denseIndex[state] == -1) {
+      const Edge *first = this->edges.data() + this->edgeOffsets[state];
+      const Edge *last = this->edges.data() + this->edgeOffsets[state + 1];
+      const Edge *edge =
+          std::lower_bound(first, last, byte, [](const Edge &edge, int wanted) {
+            return edge.byte < wanted;
+          });
+      if (edge != last && edge->byte == byte) {
+        return edge->target;
+      }
+      state = this->failures[state];
+    }
+    return this->denseRows[this->denseIndex[state] * 256 + byte];
+  }
+
+  // position is where the scan goes on when it is at the root
+  size_t skipToStart(std::string_view input, size_t position) const {
+    if (this->startBytes.empty()) {
+      return position;
+    }
+    const char *found = findAnyByte(input.data() + position,
+                                    input.size() - position, this->startBytes);
+    return found == nullptr ? input.size() : found - input.data();
+  }
+
+  // appends the literal under index to out, false if it is not one
+  static bool appendLiteral(const RegexAst &ast, int index, std::string &out) {
+    const AstNode &node = ast.getNode(ast.unwrapGroups(index));
+    if (node.kind == AstKind::Literal) {
+      out += static_cast<char>(node.byte);
+      return true;
+    }
+    if (node.kind != AstKind::Concatenation) {
+      return false;
+    }
+    for (int i = 0; i < node.childCount; i++) {
+      if (!appendLiteral(ast, ast.getChild(node, i), out)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // the branches of the alternation under index in order, false if one of
+  // them is not a literal
+  static bool appendLiterals(const RegexAst &ast, int index,
+                             std::vector<std::string> &out) {
+    const AstNode &node = ast.getNode(ast.unwrapGroups(index));
+    if (node.kind == AstKind::Alternation) {
+      for (int i = 0; i < node.childCount; i++) {
+        if (!appendLiterals(ast, ast.getChild(node, i), out)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    out.push_back(std::string());
+    return appendLiteral(ast, index, out.back()) && !out.back().empty();
+  }
+
+public:
+  AhoCorasick() {}
+
+  /*
+   * The automaton for a pattern that is nothing but an alternation of
+   * non-empty literals, nullptr for every other pattern. Literals earlier in
+   * the alternation win over later ones starting at the same position, like
+   * they do for a LeftmostFirst search of the NFA. Groups are looked through,
+   * it can not tell where they matched.
+   */
+  static std::unique_ptr<AhoCorasick> fromAst(const RegexAst &ast) {
+    std::vector<std::string> literals;
+    if (!appendLiterals(ast, ast.getRoot(), literals)) {
+      return nullptr;
+    }
+    return fromLiterals(literals);
+  }
+
+  static std::unique_ptr<AhoCorasick>
+  fromLiterals(const std::vector<std::string> &literals) {
+    std::unique_ptr<AhoCorasick> automaton = std::make_unique<AhoCorasick>();
+    automaton->literalCount = literals.size();
+
+    // the trie, children sorted by byte
+    std::vector<std::map<unsigned char, int>> children(1);
+    automaton->depths.push_back(0);
+    automaton->literals.push_back(-1);
+    for (size_t i = 0; i < literals.size(); i++) {
+      int node = root;
+      for (char c : literals[i]) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        auto found = children[node].find(byte);
+        if (found != children[node].end()) {
+          node = found->second;
+          continue;
+        }
+        int child = children.size();
+        children[node][byte] = child;
+        children.emplace_back();
+        automaton->depths.push_back(automaton->depths[node] + 1);
+        automaton->literals.push_back(-1);
+        node = child;
+      }
+      if (automaton->literals[node] == -1) {
+        automaton->literals[node] = i;
+      }
+      automaton->maxLength = std::max(automaton->maxLength, literals[i].size());
+    }
+
+    int nodeCount = children.size();
+    automaton->failures.assign(nodeCount, root);
+    automaton->outputs.assign(nodeCount, -1);
+    automaton->denseIndex.assign(nodeCount, -1);
+    automaton->edgeOffsets.push_back(0);
+    for (int node = 0; node < nodeCount; node++) {
+      for (const auto &[byte, child] : children[node]) {
+        automaton->edges.push_back(Edge{byte, child});
+      }
+      automaton->edgeOffsets.push_back(automaton->edges.size());
+    }
+    for (const auto &[byte, child] : children[root]) {
+      automaton->startBytes += static_cast<char>(byte);
+    }
+    if (automaton->startBytes.size() > maxPrefilterBytes) {
+      automaton->startBytes.clear();
+    }
+
+    // breadth first, so the failure chain of a node is done before the node
+    std::vector<int> queue = {root};
+    for (size_t head = 0; head < queue.size(); head++) {
+      int node = queue[head];
+      int failure = automaton->failures[node];
+      automaton->outputs[node] = automaton->literals[node] != -1
+                                     ? node
+                                     : automaton->outputs[failure];
+
+      if (automaton->depths[node] < denseDepth) {
+        int row = automaton->denseRows.size() / 256;
+        automaton->denseIndex[node] = row;
+        automaton->denseRows.resize(automaton->denseRows.size() + 256, root);
+        for (int byte = 0; byte < 256; byte++) {
+          auto found = children[node].find(byte);
+          if (found != children[node].end()) {
+            automaton->denseRows[row * 256 + byte] = found->second;
+          } else if (node != root) {
+            automaton->denseRows[row * 256 + byte] =
+                automaton->next(failure, byte);
+          }
+        }
+      }
+
+      for (const auto &[byte, child] : children[node]) {
+        automaton->failures[child] =
+            node == root ? root : automaton->next(failure, byte);
+        queue.push_back(child);
+      }
+    }
+
+    return automaton;
+  }
+
+  size_t getLiteralCount() const { return this->literalCount; }
+
+  int getStateCount() const { return this->depths.size(); }
+
+  size_t getMemoryUsed() const {
+    return sizeof(AhoCorasick) +
+           sizeof(int) * (this->depths.size() + this->failures.size() +
+                          this->literals.size() + this->outputs.size() +
+                          this->denseIndex.size() + this->denseRows.size() +
+                          this->edgeOffsets.size()) +
+           sizeof(Edge) * this->edges.size() + this->startBytes.size();
+  }
+
+  // true when input is one of the literals
+  bool runSimulation(std::string_view input) const {
+    int state = root;
+    for (char c : input) {
+      int child = this->next(state, static_cast<unsigned char>(c));
+      // anything but a trie edge leaves the literals input could still be
+      if (this->depths[child] != this->depths[state] + 1) {
+        return false;
+      }
+      state = child;
+    }
+    return this->literals[state] != -1;
+  }
+
+  // true when some literal occurs in input
+  bool contains(std::string_view input) const {
+    int state = root;
+    for (size_t position = 0; position < input.size(); position++) {
+      if (state == root) {
+        position = this->skipToStart(input, position);
+        if (position == input.size()) {
+          return false;
+        }
+      }
+      state = this->next(state, static_cast<unsigned char>(input[position]));
+      if (this->outputs[state] != -1) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*
+   * The leftmost occurrence of a literal starting at or after from. Of the
+   * literals starting there LeftmostFirst takes the one first in the list and
+   * LeftmostLongest the longest one. The scan goes on past the first
+   * occurrence until no literal starting at or before it can still end.
+   */
+  bool find(std::string_view input, size_t from, MatchKind kind,
+            Match &match) const {
+    bool matched = false;
+    int matchedLiteral = -1;
+    int state = root;
+    for (size_t position = from; position < input.size(); position++) {
+      if (matched && position >= match.start + this->maxLength) {
+        break;
+      }
+      if (state == root && !matched) {
+        position = this->skipToStart(input, position);
+        if (position == input.size()) {
+          break;
+        }
+      }
+      state = this->next(state, static_cast<unsigned char>(input[position]));
+
+      for (int output = this->outputs[state]; output != -1;
+           output = this->outputs[this->failures[output]]) {
+        size_t end = position + 1;
+        size_t start = end - this->depths[output];
+        int literal = this->literals[output];
+        bool better =
+            !matched || start < match.start ||
+            (start == match.start &&
+             (kind == MatchKind::LeftmostFirst ? literal < matchedLiteral
+                                               : end > match.end));
+        if (better) {
+          match.start = start;
+          match.end = end;
+          matchedLiteral = literal;
+          matched = true;
+        }
+      }
+    }
+    return matched;
+  }
+};
+
+/*
+ * Literals every match of a pattern has to contain, extracted from its syntax
+ * tree. Checking them costs a couple of memcmp calls and one vectorized
+ * substring scan, which is enough to throw out most inputs before any
+ * automaton runs.
+ */
+class Prefilter {
+private:
+  // what is known about the strings matched by a sub-expression
+  struct Literals {
+    // the sub-expression matches exactly one string, which is prefix
+    bool exact = false;
+    std::string prefix;
+    std::string suffix;
+    // longest string every match contains somewhere
+    std::string inner;
+  };
+
+  // longest literal written out for an exact repeat like (ab){3}
+  static constexpr size_t maxExactRepeat = 256;
+
+  std::string prefix;
+  std::string suffix;
+  std::string inner;
+  bool exact = false;
+
+  static std::string commonPrefix(const std::string &x, const std::string &y) {
+    size_t length = 0;
+    while (length < x.size() && length < y.size() && x[length] == y[length]) {
+      length++;
+    }
+    return x.substr(0, length);
+  }
+
+  static std::string commonSuffix(const std::string &x, const std::string &y) {
+    size_t length = 0;
+    while (length < x.size() && length < y.size() &&
+           x[x.size() - 1 - length] == y[y.size() - 1 - length]) {
+      length++;
+    }
+    return x.substr(x.size() - length);
+  }
+
+  static const std::string &longest(const std::string &x,
+                                    const std::string &y) {
+    return y.size() > x.size() ? y : x;
+  }
+
+  static Literals concatenate(const Literals &x, const Literals &y) {
+    Literals both;
+    both.exact = x.exact && y.exact;
+    both.prefix = x.exact ? x.prefix + y.prefix : x.prefix;
+    both.suffix = y.exact ? x.suffix + y.suffix : y.suffix;
+    // every match is a match of x followed by a match of y, so the suffix of
+    // x runs straight into the prefix of y
+    both.inner = longest(longest(x.inner, y.inner), x.suffix + y.prefix);
+    both.inner = longest(both.inner, both.prefix);
+    both.inner = longest(both.inner, both.suffix);
+    return both;
+  }
+
+  static Literals alternate(const Literals &x, const Literals &y) {
+    Literals either;
+    either.exact = x.exact && y.exact && x.prefix == y.prefix;
+    either.prefix = commonPrefix(x.prefix, y.prefix);
+    either.suffix = commonSuffix(x.suffix, y.suffix);
+    either.inner = longest(either.prefix, either.suffix);
+    if (x.inner == y.inner) {
+      either.inner = longest(either.inner, x.inner);
+    }
+    return either;
+  }
+
+  static Literals fromNode(const RegexAst &ast, int index) {
+    const AstNode &node = ast.getNode(index);
+    Literals literals;
+    switch (node.kind) {
+    case AstKind::Empty:
+      literals.exact = true;
+      break;
+    case AstKind::Literal:
+      literals.exact = true;
+      literals.prefix = std::string(1, static_cast<char>(node.byte));
+      literals.suffix = literals.prefix;
+      literals.inner = literals.prefix;
+      break;
+    case AstKind::Concatenation:
+      literals.exact = true;
+      for (int i = 0; i < node.childCount; i++) {
+        literals =
+            concatenate(literals, fromNode(ast, ast.getChild(node, i)));
+      }
+      break;
+    case AstKind::Alternation:
+      literals = fromNode(ast, ast.getChild(node, 0));
+      for (int i = 1; i < node.childCount; i++) {
+        literals = alternate(literals, fromNode(ast, ast.getChild(node, i)));
+      }
+      break;
+    case AstKind::Class:
+    case AstKind::Star:
+      // no single string is required of a class, a star can match the empty
+      // string
+      break;
+    case AstKind::Repeat: {
+      if (node.minCount == 0) {
+        break;
+      }
+      // the operand's literals hold for the first and last copy, and a
+      // short enough exact repeat is its operand written out
+      literals = fromNode(ast, ast.getChild(node, 0));
+      if (!literals.exact || node.maxCount != node.minCount ||
+          literals.prefix.size() * node.minCount > maxExactRepeat) {
+        literals.exact = false;
+        break;
+      }
+      std::string repeated;
+      for (int i = 0; i < node.minCount; i++) {
+        repeated += literals.prefix;
+      }
+      literals.prefix = repeated;
+      literals.suffix = repeated;
+      literals.inner = repeated;
+      break;
+    }
+    case AstKind::Group:
+      literals = fromNode(ast, ast.getChild(node, 0));
+      break;
+    }
+    return literals;
+  }
+
+public:
+  Prefilter() {}
+
+  static Prefilter fromAst(const RegexAst &ast) {
+    Literals whole = fromNode(ast, ast.getRoot());
+    Prefilter prefilter;
+    prefilter.exact = whole.exact;
+    prefilter.prefix = whole.prefix;
+    prefilter.suffix = whole.suffix;
+    prefilter.inner = whole.inner;
+    return prefilter;
+  }
+
+  const std::string &getPrefix() const { return this->prefix; }
+
+  const std::string &getSuffix() const { return this->suffix; }
+
+  const std::string &getRequired() const { return this->inner; }
+
+  bool isExact() const { return this->exact; }
+
+  // false when input cannot possibly be a full match of the pattern
+  bool mayMatch(const std::string &input) const {
+    if (this->exact) {
+      return input == this->prefix;
+    }
+    if (input.size() < this->prefix.size() ||
+        input.size() < this->suffix.size()) {
+      return false;
+    }
+    if (std::memcmp(input.data(), this->prefix.data(), this->prefix.size()) !=
+        0) {
+      return false;
+    }
+    if (std::memcmp(input.data() + input.size() - this->suffix.size(),
+                    this->suffix.data(), this->suffix.size()) != 0) {
+      return false;
+    }
+    return this->inner == this->prefix || this->inner == this->suffix ||
+           findLiteral(input.data(), input.size(), this->inner) != nullptr;
+  }
+
+  void print() const {
+    std::cout << "Prefilter { prefix: \"" << this->prefix << "\", suffix: \""
+              << this->suffix << "\", required: \"" << this->inner
+              << "\", exact: " << this->exact << " }" << std::endl;
+  }
+};
+
+// runs the automaton only on inputs that get past the prefilter
+template <typename Matcher> class PrefilteredMatcher {
+private:
+  const Prefilter *prefilter;
+  Matcher *matcher;
+
+public:
+  PrefilteredMatcher(const Prefilter &prefilter, Matcher &matcher)
+      : prefilter(&prefilter), matcher(&matcher) {}
+
+  bool runSimulation(const std::string &input) {
+    return this->prefilter->mayMatch(input) &&
+           this->matcher->runSimulation(input);
+  }
+};
+
+/*
+ * Set of patterns matched together. Every pattern is compiled on its own and
+ * the automata are then combined under a single start state, so one scan of
+ * the input through the lazy DFA of the union tells which of the patterns
+ * match. The cost per input byte is a table lookup however many patterns
+ * there are, only the number of DFA states built depends on the patterns.
+ */
+class RegexSet {
+private:
+  std::vector<std::string> patterns;
+  std::unique_ptr<Nfa> nfa;
+  std::unique_ptr<LazyDfa> dfa;
+
+public:
+  RegexSet() {}
+
+  static std::unique_ptr<RegexSet>
+  compile(const std::vector<std::string> &patterns,
+          size_t memoryBudget = 1 << 22) {
+    std::vector<std::unique_ptr<Nfa>> compiled;
+    std::vector<const Nfa *> nfas;
+    for (const std::string &pattern : patterns) {
+      compiled.push_back(buildNfa(RegexAst::parse(pattern)));
+      nfas.push_back(compiled[compiled.size() - 1].get());
+    }
+
+    std::unique_ptr<RegexSet> set = std::make_unique<RegexSet>();
+    set->patterns = patterns;
+    set->nfa = Nfa::createUnion(nfas);
+    set->dfa = std::make_unique<LazyDfa>(*set->nfa, memoryBudget);
+    return set;
+  }
+
+  int size() const { return this->patterns.size(); }
+
+  const std::string &getPattern(int patternId) const {
+    return this->patterns.at(patternId);
+  }
+
+  // ids of the patterns matching input, in increasing order
+  std::vector<int> matches(const std::string &input) {
+    return this->dfa->getMatchedPatterns(input);
+  }
+
+  bool isMatch(const std::string &input) {
+    return this->dfa->runSimulation(input);
+  }
+};
+
+/*
+ * A DFA compiled to x86-64 machine code, the generated function is
+ *
+ *   int match(const unsigned char *input, const unsigned char *end)
+ *
+ * Every state becomes a block of code that returns whether the state is
+ * accepting once the input is exhausted, otherwise loads the next byte and
+ * jumps to the block of the next state. The transitions of a state are
+ * grouped into runs of consecutive bytes going to the same state: the most
+ * common target is the fall-through jump and the other runs are range
+ * compares in front of it, states with more than maxCompareRuns runs use a
+ * jump table instead. The dead state returns right away.
+ *
+ * There are no table loads left on the hot path, only the input byte and
+ * well predicted branches. compile returns nullptr on platforms other than
+ * x86-64 Linux and macOS, callers then keep using the table driven Dfa.
+ */
+class JitDfa {
+private:
+  static constexpr int maxCompareRuns = 6;
+
+  void *code = nullptr;
+  size_t codeSize = 0;
+  int (*entry)(const unsigned char *, const unsigned char *) = nullptr;
+
+  // a rel32 at offset that has to point at the block of state
+  struct Fixup {
+    size_t offset;
+    int state;
+  };
+
+  struct Run {
+    int first;
+    int last;
+    int target;
+  };
+
+  static void emit(std::vector<unsigned char> &out,
+                   std::initializer_list<unsigned char> bytes) {
+    out.insert(out.end(), bytes);
+  }
+
+  static void emit32(std::vector<unsigned char> &out, int32_t value) {
+    unsigned char bytes[4];
+    std::memcpy(bytes, &value, 4);
+    out.insert(out.end(), bytes, bytes + 4);
+  }
+
+  static void patch32(std::vector<unsigned char> &out, size_t offset,
+                      int32_t value) {
+    std::memcpy(out.data() + offset, &value, 4);
+  }
+
+  // a jump opcode followed by a rel32 to the block of state
+  static void emitJump(std::vector<unsigned char> &out,
+                       std::initializer_list<unsigned char> opcode, int state,
+                       std::vector<Fixup> &fixups) {
+    emit(out, opcode);
+    fixups.push_back({out.size(), state});
+    emit32(out, 0);
+  }
+
+  static std::vector<unsigned char> generate(const Dfa &dfa) {
+    std::vector<unsigned char> out;
+    std::vector<Fixup> fixups;
+    std::vector<size_t> blockOffsets(dfa.getStateCount());
+    // jump tables go after the code, the lea in front of each is patched then
+    std::vector<std::pair<size_t, int>> jumpTables;
+
+    // the entry point falls through into the start state
+    std::vector<int> order;
+    order.push_back(Dfa::startState);
+    for (int state = 0; state < dfa.getStateCount(); state++) {
+      if (state != Dfa::startState) {
+        order.push_back(state);
+      }
+    }
+
+    for (int state : order) {
+      blockOffsets[state] = out.size();
+
+      if (state == Dfa::deadState) {
+        emit(out, {0x31, 0xC0, 0xC3}); // xor eax, eax; ret
+        continue;
+      }
+
+      // cmp rdi, rsi; jne over the return of whether the state accepts
+      if (dfa.isAccepting(state)) {
+        emit(out, {0x48, 0x39, 0xF7, 0x75, 0x06});
+        emit(out, {0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3}); // mov eax, 1; ret
+      } else {
+        emit(out, {0x48, 0x39, 0xF7, 0x75, 0x03});
+        emit(out, {0x31, 0xC0, 0xC3}); // xor eax, eax; ret
+      }
+      // movzx eax, byte [rdi]; inc rdi
+      emit(out, {0x0F, 0xB6, 0x07, 0x48, 0xFF, 0xC7});
+
+      std::vector<Run> runs;
+      std::vector<int> bytesTo(dfa.getStateCount(), 0);
+      for (int c = 0; c < 256; c++) {
+        int target = dfa.getTransition(state, c);
+        bytesTo[target]++;
+        if (!runs.empty() && runs.back().target == target) {
+          runs.back().last = c;
+        } else {
+          runs.push_back({c, c, target});
+        }
+      }
+      int common = std::max_element(bytesTo.begin(), bytesTo.end()) -
+                   bytesTo.begin();
+
+      if (runs.size() > maxCompareRuns + 1) {
+        // lea rcx, [rip + table]; movsxd rdx, [rcx + rax * 4];
+        // add rdx, rcx; jmp rdx
+        emit(out, {0x48, 0x8D, 0x0D});
+        jumpTables.push_back({out.size(), state});
+        emit32(out, 0);
+        emit(out, {0x48, 0x63, 0x14, 0x81, 0x48, 0x01, 0xCA, 0xFF, 0xE2});
+        continue;
+      }
+
+      for (const Run &run : runs) {
+        if (run.target == common) {
+          continue;
+        }
+        if (run.first == run.last) {
+          emit(out, {0x3D}); // cmp eax, imm32
+          emit32(out, run.first);
+          emitJump(out, {0x0F, 0x84}, run.target, fixups); // je
+        } else {
+          emit(out, {0x8D, 0x88}); // lea ecx, [rax - first]
+          emit32(out, -run.first);
+          emit(out, {0x81, 0xF9}); // cmp ecx, imm32
+          emit32(out, run.last - run.first);
+          emitJump(out, {0x0F, 0x86}, run.target, fixups); // jbe
+        }
+      }
+      emitJump(out, {0xE9}, common, fixups); // jmp
+    }
+
+    for (const Fixup &fixup : fixups) {
+      patch32(out, fixup.offset,
+              blockOffsets[fixup.state] - (fixup.offset + 4));
+    }
+
+    for (const auto &[leaOffset, state] : jumpTables) {
+      while (out.size() % 4 != 0) {
+        out.push_back(0xCC);
+      }
+      size_t table = out.size();
+      patch32(out, leaOffset, table - (leaOffset + 4));
+      for (int c = 0; c < 256; c++) {
+        emit32(out, blockOffsets[dfa.getTransition(state, c)] - table);
+      }
+    }
+
+    return out;
+  }
+
+public:
+  JitDfa() {}
+
+  ~JitDfa() {
+#if defined(REGEX_JIT)
+    if (this->code != nullptr) {
+      munmap(this->code, this->codeSize);
+    }
+#endif
+  }
+
+  JitDfa(const JitDfa &) = delete;
+  JitDfa &operator=(const JitDfa &) = delete;
+
+  static std::unique_ptr<JitDfa> compile(const Dfa &dfa) {
+#if defined(REGEX_JIT)
+    std::vector<unsigned char> generated = generate(dfa);
+
+    void *code = mmap(nullptr, generated.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+      return nullptr;
+    }
+    std::memcpy(code, generated.data(), generated.size());
+    // never writable and executable at the same time
+    if (mprotect(code, generated.size(), PROT_READ | PROT_EXEC) != 0) {
+      munmap(code, generated.size());
+      return nullptr;
+    }
+
+    std::unique_ptr<JitDfa> jit = std::make_unique<JitDfa>();
+    jit->code = code;
+    jit->codeSize = generated.size();
+    jit->entry = reinterpret_cast<int (*)(const unsigned char *,
+                                          const unsigned char *)>(code);
+    return jit;
+#else
+    (void)dfa;
+    return nullptr;
+#endif
+  }
+
+  size_t getCodeSize() const { return this->codeSize; }
+
+  bool runSimulation(std::string_view input) const {
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(input.data());
+    return this->entry(data, data + input.size());
+  }
+};
+
+// one bit per input of a batch, set when that input matched
+class MatchBitmap {
+private:
+  std::vector<uint64_t> words;
+  size_t bitCount = 0;
+
+public:
+  MatchBitmap() {}
+
+  explicit MatchBitmap(size_t size)
+      : words((size + 63) / 64, 0), bitCount(size) {}
+
+  bool test(size_t i) const { return (this->words[i / 64] >> (i % 64)) & 1; }
+
+  void set(size_t i) { this->words[i / 64] |= uint64_t(1) << (i % 64); }
+
+  size_t size() const { return this->bitCount; }
+
+  size_t count() const {
+    size_t total = 0;
+    for (uint64_t word : this->words) {
+      total += __builtin_popcountll(word);
+    }
+    return total;
+  }
+};
+
+/*
+ * The engines Regex picks from. Every operation of a compiled pattern runs
+ * one of them, which one is decided once by Regex::compile and can be looked
+ * at through Regex::getPlan.
+ */
+enum class Engine {
+  // the operation is not supported for the pattern and throws
+  None,
+  // the pattern is one literal, compared with memcmp or found by findLiteral
+  Literal,
+  AhoCorasick,
+  Jit,
+  Dfa,
+  // the leftmost-first DFA forward to the end, the reverse DFA back to the
+  // start
+  ReverseDfa,
+  LazyDfa,
+  BitParallel,
+  Counters,
+  Nfa,
+  OnePass,
+  PikeVm
+};
+
+inline const char *engineName(Engine engine) {
+  switch (engine) {
+  case Engine::None:
+    return "none";
+  case Engine::Literal:
+    return "literal";
+  case Engine::AhoCorasick:
+    return "aho-corasick";
+  case Engine::Jit:
+    return "jit";
+  case Engine::Dfa:
+    return "dfa";
+  case Engine::ReverseDfa:
+    return "reverse dfa";
+  case Engine::LazyDfa:
+    return "lazy dfa";
+  case Engine::BitParallel:
+    return "bit-parallel";
+  case Engine::Counters:
+    return "counters";
+  case Engine::Nfa:
+    return "nfa";
+  case Engine::OnePass:
+    return "one-pass";
+  case Engine::PikeVm:
+    return "pike vm";
+  }
+  return "unknown";
+}
+
+// the engines Regex::compile chose for a pattern and what it went by
+struct RegexPlan {
+  Engine isMatch = Engine::Nfa;
+  Engine contains = Engine::Nfa;
+  Engine find = Engine::Nfa;
+  // matchGroups and findGroups, the engine of find for patterns without
+  // groups
+  Engine groups = Engine::Nfa;
+
+  // nodes of the parsed pattern with every repeat written out, saturating
+  size_t expandedSize = 0;
+  int groupCount = 0;
+  size_t literalCount = 0;
+  // states of the NFA and of the minimal DFA, 0 when they were not built
+  int nfaStates = 0;
+  int dfaStates = 0;
+  // literal every match contains, checked before any engine runs
+  std::string required;
+
+  std::string toString() const {
+    std::string out = std::string("isMatch: ") + engineName(this->isMatch) +
+                      ", contains: " + engineName(this->contains) +
+                      ", find: " + engineName(this->find) +
+                      ", groups: " + engineName(this->groups);
+    if (this->nfaStates > 0) {
+      out += ", " + std::to_string(this->nfaStates) + " NFA states";
+    }
+    if (this->dfaStates > 0) {
+      out += ", " + std::to_string(this->dfaStates) + " DFA states";
+    }
+    if (this->literalCount > 0) {
+      out += ", " + std::to_string(this->literalCount) + " literals";
+    }
+    if (!this->required.empty()) {
+      out += ", requires " + this->required;
+    }
+    return out;
+  }
+};
+
+/*
+ * A compiled pattern. Regex::compile builds whichever automata fit within
+ * their limits and records in a RegexPlan which engine every operation runs
+ * on, see Regex::compile for how it picks and Regex::getPlan to look at the
+ * result. Unanchored searches first have to get past the literal prefilter:
+ * inputs missing a required literal are rejected without running any
+ * automaton.
+ *
+ * Nothing is modified after compile except the pool of lazy DFAs, which is
+ * guarded by a mutex, and every matching method is const, so one Regex can
+ * be shared by any number of threads matching at the same time.
+ */
+class Regex {
+private:
+  static constexpr int maxDfaStates = 10000;
+  static constexpr size_t batchBlockSize = 1024;
+  // shorter literal lists keep their DFAs, which can be jit compiled and
+  // stored in automaton files
+  static constexpr size_t minAhoCorasickLiterals = 32;
+  // cache of every lazy DFA isMatch uses when the DFA grew too big
+  static constexpr size_t lazyDfaBudget = 1 << 20;
+  // lazy DFAs kept between calls, more threads matching at once build
+  // caches of their own that are dropped afterwards
+  static constexpr size_t maxPooledLazyDfas = 4;
+
+  std::string pattern;
+  RegexPlan plan;
+  std::unique_ptr<Nfa> nfa;
+  Prefilter prefilter;
+  std::unique_ptr<Dfa> dfa;
+  std::unique_ptr<Dfa> unanchoredDfa;
+  // find runs the first to where a match ends and the second, built from the
+  // reversed pattern, back from there to where it starts
+  std::unique_ptr<Dfa> leftmostDfa;
+  std::unique_ptr<Dfa> reverseDfa;
+  std::unique_ptr<JitDfa> jit;
+  std::unique_ptr<GlushkovNfa> glushkov;
+  // only for patterns with capture groups, the one-pass DFA when the pattern
+  // is one-pass
+  std::unique_ptr<PikeVm> pikeVm;
+  std::unique_ptr<OnePassDfa> onePass;
+  // instead of all of the above when the repeats are too large to write out
+  std::unique_ptr<CountingNfa> counting;
+  // instead of all of the above for long lists of literals
+  std::unique_ptr<AhoCorasick> ahoCorasick;
+  // lazy DFAs kept warm between isMatch calls. A cache changes while it
+  // matches, so every call takes one out of the pool, or builds one when all
+  // are taken by other threads, and puts it back once done unless the pool
+  // already holds maxPooledLazyDfas
+  mutable std::mutex lazyDfaLock;
+  mutable std::vector<std::unique_ptr<LazyDfa>> lazyDfas;
+
+  std::unique_ptr<LazyDfa> takeLazyDfa() const {
+    {
+      std::lock_guard<std::mutex> guard(this->lazyDfaLock);
+      if (!this->lazyDfas.empty()) {
+        std::unique_ptr<LazyDfa> lazyDfa = std::move(this->lazyDfas.back());
+        this->lazyDfas.pop_back();
+        return lazyDfa;
+      }
+    }
+    return std::make_unique<LazyDfa>(*this->nfa, lazyDfaBudget);
+  }
+
+  void returnLazyDfa(std::unique_ptr<LazyDfa> lazyDfa) const {
+    std::lock_guard<std::mutex> guard(this->lazyDfaLock);
+    if (this->lazyDfas.size() < maxPooledLazyDfas) {
+      this->lazyDfas.push_back(std::move(lazyDfa));
+    }
+  }
+
+  // picks the engine of every operation from the automata compile built
+  void choosePlan() {
+    bool literal = this->prefilter.isExact();
+    if (this->jit != nullptr) {
+      this->plan.isMatch = Engine::Jit;
+    } else if (this->dfa != nullptr) {
+      this->plan.isMatch = Engine::Dfa;
+    } else if (this->glushkov != nullptr) {
+      this->plan.isMatch = Engine::BitParallel;
+    } else {
+      this->plan.isMatch = Engine::LazyDfa;
+    }
+    this->plan.contains =
+        this->unanchoredDfa != nullptr ? Engine::Dfa : Engine::Nfa;
+    this->plan.find =
+        this->leftmostDfa != nullptr ? Engine::ReverseDfa : Engine::Nfa;
+    if (literal) {
+      this->plan.isMatch = Engine::Literal;
+      this->plan.contains = Engine::Literal;
+      this->plan.find = Engine::Literal;
+    }
+    this->plan.groups = this->plan.find;
+    if (this->pikeVm != nullptr) {
+      this->plan.groups =
+          this->onePass != nullptr ? Engine::OnePass : Engine::PikeVm;
+    }
+  }
+
+public:
+  Regex() {}
+
+  /*
+   * The planner: compiles pattern into whatever automata suit it and picks
+   * the engine every operation runs, see getPlan.
+   *
+   *  - alternations of at least minAhoCorasickLiterals literals and no
+   *    groups only get an AhoCorasick automaton,
+   *  - every other pattern is simplified, and when its repeats written out
+   *    have more than RegexAst::maxExpandedSize nodes it only gets a
+   *    CountingNfa, which can match but not find,
+   *  - otherwise the NFA is built and determinized, which gives up past
+   *    maxDfaStates states or subsetBudget NFA states per DFA state. Without
+   *    a DFA isMatch runs the bit-parallel automaton if the pattern has few
+   *    enough positions and a lazy DFA if not,
+   *  - patterns that are one literal are compared and searched for as such,
+   *  - patterns with groups get a PikeVm, and a OnePassDfa if they are
+   *    one-pass.
+   *
+   * jit compiles the minimal DFA to machine code where that is supported.
+   */
+  static std::unique_ptr<Regex> compile(const std::string &pattern,
+                                        bool jit = false) {
+    std::unique_ptr<Regex> regex = std::make_unique<Regex>();
+    regex->pattern = pattern;
+
+    RegexAst ast = RegexAst::parse(pattern);
+    RegexPlan &plan = regex->plan;
+    plan.expandedSize = ast.getExpandedSize();
+    plan.groupCount = ast.getGroupCount();
+    std::unique_ptr<AhoCorasick> ahoCorasick = AhoCorasick::fromAst(ast);
+    if (ahoCorasick != nullptr && ast.getGroupCount() == 0 &&
+        ahoCorasick->getLiteralCount() >= minAhoCorasickLiterals) {
+      plan.literalCount = ahoCorasick->getLiteralCount();
+      plan.isMatch = plan.contains = plan.find = plan.groups =
+          Engine::AhoCorasick;
+      regex->ahoCorasick = std::move(ahoCorasick);
+      return regex;
+    }
+    // the automata that only match have no use for the groups
+    RegexAst plain = ast.simplify(false);
+    regex->prefilter = Prefilter::fromAst(plain);
+    plan.required = regex->prefilter.getRequired();
+    if (plain.getExpandedSize() > RegexAst::maxExpandedSize) {
+      plan.isMatch = plan.contains = Engine::Counters;
+      plan.find = plan.groups = Engine::None;
+      regex->counting = CountingNfa::fromAst(plain);
+      return regex;
+    }
+    regex->nfa = buildNfa(plain);
+    plan.nfaStates = regex->nfa->getStateCount();
+
+    std::unique_ptr<Dfa> dfa = Dfa::fromNfa(*regex->nfa, false, maxDfaStates);
+    if (dfa != nullptr) {
+      regex->dfa = Dfa::minimize(*dfa);
+      plan.dfaStates = regex->dfa->getStateCount();
+    } else {
+      regex->glushkov = GlushkovNfa::fromAst(plain);
+    }
+    std::unique_ptr<Dfa> unanchoredDfa =
+        Dfa::fromNfa(*regex->nfa, true, maxDfaStates);
+    if (unanchoredDfa != nullptr) {
+      regex->unanchoredDfa = Dfa::minimize(*unanchoredDfa);
+    }
+    if (regex->dfa != nullptr) {
+      std::unique_ptr<Dfa> leftmostDfa =
+          Dfa::leftmostFirstFromNfa(*regex->nfa, maxDfaStates);
+      std::unique_ptr<Dfa> reverseDfa =
+          Dfa::fromNfa(*Nfa::reverse(*regex->nfa), false, maxDfaStates);
+      if (leftmostDfa != nullptr && reverseDfa != nullptr) {
+        regex->leftmostDfa = Dfa::minimize(*leftmostDfa);
+        regex->reverseDfa = Dfa::minimize(*reverseDfa);
+      }
+    }
+    if (jit && regex->dfa != nullptr) {
+      regex->jit = JitDfa::compile(*regex->dfa);
+    }
+    if (ast.getGroupCount() > 0) {
+      regex->pikeVm = PikeVm::fromAst(ast.simplify());
+      regex->onePass = OnePassDfa::fromPikeVm(*regex->pikeVm);
+    }
+    regex->choosePlan();
+
+    return regex;
+  }
+
+  const RegexPlan &getPlan() const { return this->plan; }
+
+  // lazy DFAs in the pool and the states cached by all of them together
+  size_t getLazyDfaCount() const {
+    std::lock_guard<std::mutex> guard(this->lazyDfaLock);
+    return this->lazyDfas.size();
+  }
+
+  int getLazyDfaStateCount() const {
+    std::lock_guard<std::mutex> guard(this->lazyDfaLock);
+    int states = 0;
+    for (const std::unique_ptr<LazyDfa> &lazyDfa : this->lazyDfas) {
+      states += lazyDfa->getStateCount();
+    }
+    return states;
+  }
+
+  const std::string &getPattern() const { return this->pattern; }
+
+  const Prefilter &getPrefilter() const { return this->prefilter; }
+
+  bool isJitCompiled() const { return this->jit != nullptr; }
+
+  bool usesCounters() const { return this->counting != nullptr; }
+
+  bool usesAhoCorasick() const { return this->ahoCorasick != nullptr; }
+
+  // capture groups, numbered from 1 by their opening parenthesis
+  int getGroupCount() const {
+    return this->pikeVm != nullptr ? this->pikeVm->getGroupCount() : 0;
+  }
+
+  // what matchGroups runs instead of the PikeVm, nullptr if the pattern is
+  // not one-pass or has no groups
+  const OnePassDfa *getOnePassDfa() const { return this->onePass.get(); }
+
+  // nullptr when the pattern uses counters or Aho-Corasick instead
+  const Nfa *getNfa() const { return this->nfa.get(); }
+
+  // the automata behind isMatch and contains, nullptr when they grew too big
+  const Dfa *getDfa() const { return this->dfa.get(); }
+
+  const Dfa *getUnanchoredDfa() const { return this->unanchoredDfa.get(); }
+
+  // the automata behind find, nullptr when it has to run the NFA
+  const Dfa *getLeftmostDfa() const { return this->leftmostDfa.get(); }
+
+  const Dfa *getReverseDfa() const { return this->reverseDfa.get(); }
+
+  // bytes held by the compiled automata, counting the lazy DFA pool as full
+  // since it fills up after compile, out of sight of a RegexCache
+  size_t getMemoryUsed() const {
+    size_t used = sizeof(Regex) + this->pattern.size();
+    if (this->counting != nullptr) {
+      return used + this->counting->getMemoryUsed();
+    }
+    if (this->ahoCorasick != nullptr) {
+      return used + this->ahoCorasick->getMemoryUsed();
+    }
+    used += this->nfa->getMemoryUsed();
+    if (this->plan.isMatch == Engine::LazyDfa) {
+      used += maxPooledLazyDfas * lazyDfaBudget;
+    }
+    if (this->dfa != nullptr) {
+      used += this->dfa->getMemoryUsed();
+    }
+    if (this->unanchoredDfa != nullptr) {
+      used += this->unanchoredDfa->getMemoryUsed();
+    }
+    if (this->leftmostDfa != nullptr) {
+      used += this->leftmostDfa->getMemoryUsed() +
+              this->reverseDfa->getMemoryUsed();
+    }
+    if (this->jit != nullptr) {
+      used += this->jit->getCodeSize();
+    }
+    if (this->glushkov != nullptr) {
+      used += this->glushkov->getMemoryUsed();
+    }
+    if (this->pikeVm != nullptr) {
+      used += this->pikeVm->getMemoryUsed();
+    }
+    if (this->onePass != nullptr) {
+      used += this->onePass->getMemoryUsed();
+    }
+    return used;
+  }
+
+  // true when the whole input matches
+  bool isMatch(std::string_view input) const {
+    switch (this->plan.isMatch) {
+    case Engine::Literal:
+      return input == this->prefilter.getPrefix();
+    case Engine::AhoCorasick:
+      return this->ahoCorasick->runSimulation(input);
+    case Engine::Jit:
+      return this->jit->runSimulation(input);
+    case Engine::Dfa:
+      return this->dfa->runSimulation(input);
+    case Engine::BitParallel:
+      return this->glushkov->runSimulation(input);
+    case Engine::Counters:
+      return this->counting->runSimulation(input);
+    case Engine::LazyDfa: {
+      std::unique_ptr<LazyDfa> lazyDfa = this->takeLazyDfa();
+      bool matched = lazyDfa->runSimulation(input);
+      this->returnLazyDfa(std::move(lazyDfa));
+      return matched;
+    }
+    default:
+      return this->nfa->runSimulation(input);
+    }
+  }
+
+  // isMatch spread over threadCount threads, for inputs of many megabytes
+  bool isMatch(std::string_view input, int threadCount) const {
+    if (this->dfa != nullptr) {
+      return this->dfa->runSimulationParallel(input, threadCount);
+    }
+    return this->isMatch(input);
+  }
+
+  /*
+   * isMatch for every input, bit i of the result is set when inputs[i]
+   * matches. Threads take blocks of batchBlockSize inputs from a shared
+   * counter until none are left, so a few slow inputs do not hold up a
+   * whole thread's share. Each block covers whole bitmap words, which keeps
+   * threads from ever writing the same word.
+   */
+  MatchBitmap matchMany(std::span<const std::string_view> inputs,
+                        int threadCount = 1) const {
+    MatchBitmap result(inputs.size());
+    size_t blockCount = (inputs.size() + batchBlockSize - 1) / batchBlockSize;
+    std::atomic<size_t> nextBlock(0);
+
+    auto work = [this, &inputs, &result, &nextBlock, blockCount] {
+      char accepted[batchBlockSize];
+      for (size_t block = nextBlock++; block < blockCount;
+           block = nextBlock++) {
+        size_t first = block * batchBlockSize;
+        size_t count = std::min(batchBlockSize, inputs.size() - first);
+        if (this->dfa != nullptr) {
+          this->dfa->runSimulationBatch(inputs.data() + first, count,
+                                        accepted);
+        } else {
+          for (size_t i = 0; i < count; i++) {
+            accepted[i] = this->isMatch(inputs[first + i]);
+          }
+        }
+        for (size_t i = 0; i < count; i++) {
+          if (accepted[i]) {
+            result.set(first + i);
+          }
+        }
+      }
+    };
+
+    // the calling thread is one of the workers
+    size_t threads = std::min<size_t>(std::max(threadCount, 1), blockCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+      workers.push_back(std::thread(work));
+    }
+    work();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+
+    return result;
+  }
+
+  // true when some part of the input matches
+  bool contains(std::string_view input) const {
+    const std::string &required = this->prefilter.getRequired();
+    if (findLiteralFrom(input, 0, required) == std::string_view::npos) {
+      return false;
+    }
+    switch (this->plan.contains) {
+    case Engine::Literal: {
+      const std::string &literal = this->prefilter.getPrefix();
+      return findLiteralFrom(input, 0, literal) != std::string_view::npos;
+    }
+    case Engine::AhoCorasick:
+      return this->ahoCorasick->contains(input);
+    case Engine::Dfa:
+      return this->unanchoredDfa->runSimulation(input);
+    case Engine::Counters:
+      return this->counting->contains(input);
+    default: {
+      Match match;
+      return this->nfa->search(input, 0, MatchKind::LeftmostFirst, match,
+                               this->prefilter.getPrefix());
+    }
+    }
+  }
+
+  /*
+   * The leftmost match starting at or after from, throws std::logic_error for
+   * patterns that use counters. When the DFAs could be built the match never
+   * touches the NFA: the leftmost-first DFA runs forward to where the match
+   * ends, the reverse DFA runs back from there to the lowest position it
+   * accepts at, which is where the match starts. A leftmost-longest match
+   * starts at the same position and ends where the anchored DFA last accepts
+   * from there.
+   */
+  bool find(std::string_view input, Match &match, size_t from = 0,
+            MatchKind kind = MatchKind::LeftmostFirst) const {
+    if (this->plan.find == Engine::None) {
+      throw std::logic_error("Regex " + this->pattern +
+                             " uses counters and can not report matches");
+    }
+    if (from > input.size()) {
+      return false;
+    }
+    if (this->plan.find == Engine::AhoCorasick) {
+      return this->ahoCorasick->find(input, from, kind, match);
+    }
+    if (this->plan.find == Engine::Literal) {
+      const std::string &literal = this->prefilter.getPrefix();
+      size_t found = findLiteralFrom(input, from, literal);
+      if (found == std::string_view::npos) {
+        return false;
+      }
+      match.start = found;
+      match.end = match.start + literal.size();
+      return true;
+    }
+    const std::string &required = this->prefilter.getRequired();
+    if (findLiteralFrom(input, from, required) == std::string_view::npos) {
+      return false;
+    }
+    if (this->plan.find == Engine::ReverseDfa) {
+      size_t end;
+      if (!this->leftmostDfa->longestMatchEnd(input, from, end)) {
+        return false;
+      }
+      this->reverseDfa->longestMatchStart(input, from, end, match.start);
+      match.end = end;
+      if (kind == MatchKind::LeftmostLongest) {
+        this->dfa->longestMatchEnd(input, match.start, match.end);
+      }
+      return true;
+    }
+    return this->nfa->search(input, from, kind, match,
+                             this->prefilter.getPrefix());
+  }
+
+  /*
+   * isMatch that also reports where the capture groups matched: groups[0]
+   * is the whole input and groups[i] the part group i matched, the last
+   * iteration when it is repeated and both ends npos when it did not take
+   * part. One-pass patterns take one DFA lookup per byte, the others run the
+   * PikeVm. Throws std::logic_error for patterns that use counters.
+   */
+  bool matchGroups(std::string_view input, std::vector<Match> &groups) const {
+    switch (this->plan.groups) {
+    case Engine::None:
+      throw std::logic_error("Regex " + this->pattern +
+                             " uses counters and can not report matches");
+    case Engine::OnePass:
+      return this->onePass->fullMatch(input, groups);
+    case Engine::PikeVm:
+      return this->pikeVm->fullMatch(input, groups);
+    default:
+      if (!this->isMatch(input)) {
+        return false;
+      }
+      groups.assign(1, Match{0, input.size()});
+      return true;
+    }
+  }
+
+  /*
+   * find that also reports the capture groups like matchGroups does. The
+   * match itself is found by find first, so usually without the NFA, then
+   * only its bytes are run again to place the groups: whatever thread wins
+   * the leftmost-first search is the first in priority order among those
+   * matching exactly those bytes.
+   */
+  bool findGroups(std::string_view input, std::vector<Match> &groups,
+                  size_t from = 0) const {
+    Match match;
+    if (!this->find(input, match, from)) {
+      return false;
+    }
+    if (this->pikeVm == nullptr) {
+      groups.assign(1, match);
+      return true;
+    }
+    this->matchGroups(input.substr(match.start, match.end - match.start),
+                      groups);
+    for (Match &group : groups) {
+      if (group.start != std::string_view::npos) {
+        group.start += match.start;
+        group.end += match.start;
+      }
+    }
+    return true;
+  }
+
+  // every non overlapping match from left to right, an empty match moves the
+  // search on by one byte
+  std::vector<Match> findAll(std::string_view input,
+                             MatchKind kind = MatchKind::LeftmostFirst) const {
+    std::vector<Match> matches;
+    Match match;
+    size_t from = 0;
+    while (this->find(input, match, from, kind)) {
+      matches.push_back(match);
+      from = match.end > match.start ? match.end : match.end + 1;
+    }
+    return matches;
+  }
+};
+
+/*
+ * Finds the matches of a Regex in input that arrives in chunks, for streams
+ * that can not be held in memory as a whole. The matches are the ones findAll
+ * would report for all chunks put together, with offsets from the start of
+ * the stream, including matches that span chunks.
+ *
+ * This is Nfa::search kept running between calls: the threads and where
+ * each started carry over from one chunk to the next, so the bytes of a
+ * match are never needed once scanned. The only bytes kept are those after
+ * a match that could still grow, the search for the next match resumes
+ * from there once it is over. Those are at most maxLookahead bytes, a match
+ * still growing past that is reported as it is, so memory stays bounded by
+ * the size of the NFA plus maxLookahead.
+ *
+ * Throws std::logic_error for patterns that use counters. A matcher belongs
+ * to one thread, the Regex can be shared.
+ */
+class StreamMatcher {
+private:
+  static constexpr size_t defaultMaxLookahead = 1 << 16;
+  // findAnyByte is only faster than running the threads for a few bytes
+  static constexpr size_t maxStartBytes = 4;
+
+  const Nfa *nfa;
+  // the NFA of Aho-Corasick patterns, which the Regex does not keep
+  std::unique_ptr<Nfa> ownNfa;
+  // every match starts with prefix, or else with one of startBytes when
+  // there are few enough of them to search for
+  std::string prefix;
+  std::string startBytes;
+  MatchKind kind;
+  size_t maxLookahead;
+
+  SparseSet current;
+  SparseSet next;
+  std::vector<size_t> currentStarts;
+  std::vector<size_t> nextStarts;
+  bool matched = false;
+  Match match;
+  // the byte at position is the next one the threads step over
+  size_t position = 0;
+  // the byte at position is skipped without starting threads, after an
+  // empty match
+  bool skipping = false;
+  // the scanned bytes from offset bufferStart on that the search might have
+  // to run again, kept while matched
+  std::string buffer;
+  size_t bufferStart = 0;
+
+  // drops the buffered bytes before offset
+  void keepFrom(size_t offset) {
+    size_t unused = offset - this->bufferStart;
+    if (unused > 0 && unused >= this->buffer.size() / 2) {
+      this->buffer.erase(0, unused);
+      this->bufferStart = offset;
+    }
+  }
+
+  // moves chunk[i] and position on to where the next match can start, only
+  // the end of the chunk is left for a prefix that goes on in the next one
+  void skipToStart(std::string_view chunk, size_t &i) {
+    size_t skipTo = i;
+    if (!this->prefix.empty()) {
+      const char *candidate =
+          findLiteral(chunk.data() + i, chunk.size() - i, this->prefix);
+      skipTo = candidate != nullptr
+                   ? candidate - chunk.data()
+                   : std::max(i, chunk.size() - std::min(chunk.size(),
+                                                         this->prefix.size() -
+                                                             1));
+    } else if (!this->startBytes.empty()) {
+      const char *candidate =
+          findAnyByte(chunk.data() + i, chunk.size() - i, this->startBytes);
+      skipTo = candidate != nullptr ? candidate - chunk.data() : chunk.size();
+    }
+    this->position += skipTo - i;
+    i = skipTo;
+  }
+
+  // reports the match and goes back to where the next search starts
+  void settle(std::vector<Match> &matches) {
+    matches.push_back(this->match);
+    this->matched = false;
+    this->current.clear();
+    this->position = this->match.end;
+    this->skipping = this->match.end == this->match.start;
+    this->keepFrom(this->position);
+  }
+
+  // runs the threads over the buffered bytes and then over chunk, finished
+  // when chunk is the last of the stream
+  void scan(std::string_view chunk, bool finished,
+            std::vector<Match> &matches) {
+    size_t i = 0;
+    while (true) {
+      if (!this->skipping) {
+        if (!this->matched) {
+          size_t bufferEnd = this->bufferStart + this->buffer.size();
+          if (this->current.empty() && this->position >= bufferEnd) {
+            this->skipToStart(chunk, i);
+          }
+          this->nfa->startThreads(this->current, this->currentStarts,
+                                  this->position);
+        }
+        bool wasMatched = this->matched;
+        this->matched = this->nfa->acceptThreads(
+            this->current, this->currentStarts, this->position, this->kind,
+            this->matched, this->match);
+        if (this->matched) {
+          if (!wasMatched &&
+              this->position >= this->bufferStart + this->buffer.size()) {
+            this->buffer.clear();
+            this->bufferStart = this->position;
+          }
+          this->keepFrom(this->match.end);
+          if (this->current.empty()) {
+            this->settle(matches);
+            continue;
+          }
+        }
+      }
+
+      unsigned char c;
+      size_t bufferEnd = this->bufferStart + this->buffer.size();
+      if (this->position < bufferEnd) {
+        c = this->buffer[this->position - this->bufferStart];
+      } else if (i < chunk.size()) {
+        c = chunk[i++];
+        if (this->matched) {
+          this->buffer.push_back(c);
+        } else {
+          this->buffer.clear();
+          this->bufferStart = this->position + 1;
+        }
+      } else if (finished && this->matched) {
+        // nothing can grow the match anymore
+        this->current.clear();
+        this->settle(matches);
+        continue;
+      } else {
+        break;
+      }
+
+      if (this->skipping) {
+        this->skipping = false;
+        this->position++;
+        continue;
+      }
+      this->nfa->stepThreads(this->current, this->currentStarts, c,
+                             this->next, this->nextStarts);
+      std::swap(this->current, this->next);
+      std::swap(this->currentStarts, this->nextStarts);
+      this->position++;
+      if (this->matched &&
+          this->position - this->match.end > this->maxLookahead) {
+        this->current.clear();
+      }
+    }
+  }
+
+public:
+  StreamMatcher(const Regex &regex, MatchKind kind = MatchKind::LeftmostFirst,
+                size_t maxLookahead = defaultMaxLookahead)
+      : nfa(regex.getNfa()), kind(kind), maxLookahead(maxLookahead),
+        current(0), next(0) {
+    if (regex.usesCounters()) {
+      throw std::logic_error("Regex " + regex.getPattern() +
+                             " uses counters and can not report matches");
+    }
+    if (this->nfa == nullptr) {
+      this->ownNfa =
+          buildNfa(RegexAst::parse(regex.getPattern()).simplify(false));
+      this->nfa = this->ownNfa.get();
+    } else {
+      this->prefix = regex.getPrefilter().getPrefix();
+    }
+    if (this->prefix.empty()) {
+      this->startBytes = this->nfa->getStartBytes(maxStartBytes);
+    }
+    int stateCount = this->nfa->getStateCount();
+    this->current = SparseSet(stateCount);
+    this->next = SparseSet(stateCount);
+    this->currentStarts.resize(stateCount);
+    this->nextStarts.resize(stateCount);
+  }
+
+  // the matches that are over once chunk is scanned, in order
+  std::vector<Match> feed(std::string_view chunk) {
+    std::vector<Match> matches;
+    this->scan(chunk, false, matches);
+    return matches;
+  }
+
+  // the matches left at the end of the stream, after which the matcher
+  // starts on a new stream
+  std::vector<Match> finish() {
+    std::vector<Match> matches;
+    this->scan(std::string_view(), true, matches);
+    this->reset();
+    return matches;
+  }
+
+  void reset() {
+    this->current.clear();
+    this->matched = false;
+    this->position = 0;
+    this->skipping = false;
+    this->buffer.clear();
+    this->bufferStart = 0;
+  }
+
+  // offset of the next byte to scan
+  size_t getOffset() const {
+    return std::max(this->position, this->bufferStart + this->buffer.size());
+  }
+
+  // bytes kept from the stream
+  size_t getBuffered() const { return this->buffer.size(); }
+};
+
+/*
+ * Compiled regexes by pattern and flags, so compiling a pattern seen before
+ * is a hash lookup. The least recently used entries are evicted once there
+ * are more than maxEntries of them or they hold more than maxMemory bytes,
+ * the most recent entry is kept even if it alone is over the limit.
+ *
+ * Entries are shared: evicting one only drops the cache's reference, callers
+ * still holding it keep using it. All methods can be called from any thread.
+ * Patterns are compiled outside the lock, two threads missing on the same
+ * pattern at once both compile it and the first one to finish wins.
+ */
+class RegexCache {
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const Regex> regex;
+    size_t memory;
+  };
+
+  size_t maxEntries;
+  size_t maxMemory;
+
+  mutable std::mutex lock;
+  // most recently used first
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  size_t memoryUsed = 0;
+
+  size_t hitCount = 0;
+  size_t missCount = 0;
+  size_t evictionCount = 0;
+
+  static std::string makeKey(const std::string &pattern, bool jit) {
+    return std::string(1, jit ? 'j' : '-') + pattern;
+  }
+
+  void evict() {
+    while (this->entries.size() > 1 &&
+           (this->entries.size() > this->maxEntries ||
+            this->memoryUsed > this->maxMemory)) {
+      Entry &oldest = this->entries.back();
+      this->memoryUsed -= oldest.memory;
+      this->index.erase(oldest.key);
+      this->entries.pop_back();
+      this->evictionCount++;
+    }
+  }
+
+public:
+  explicit RegexCache(size_t maxEntries = 1024, size_t maxMemory = 64 << 20)
+      : maxEntries(maxEntries), maxMemory(maxMemory) {}
+
+  // the compiled pattern, compiling it first unless it is cached. Invalid
+  // patterns throw like Regex::compile and are not cached
+  std::shared_ptr<const Regex> get(const std::string &pattern,
+                                   bool jit = false) {
+    std::string key = makeKey(pattern, jit);
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      auto found = this->index.find(key);
+      if (found != this->index.end()) {
+        this->hitCount++;
+        this->entries.splice(this->entries.begin(), this->entries,
+                             found->second);
+        return found->second->regex;
+      }
+      this->missCount++;
+    }
+
+    std::shared_ptr<const Regex> compiled = Regex::compile(pattern, jit);
+    size_t memory = compiled->getMemoryUsed();
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto found = this->index.find(key);
+    if (found != this->index.end()) {
+      // another thread compiled it first, it is just as recently used
+      this->entries.splice(this->entries.begin(), this->entries,
+                           found->second);
+      return found->second->regex;
+    }
+    this->entries.push_front({key, compiled, memory});
+    this->index[key] = this->entries.begin();
+    this->memoryUsed += memory;
+    this->evict();
+    return compiled;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->entries.clear();
+    this->index.clear();
+    this->memoryUsed = 0;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->entries.size();
+  }
+
+  size_t getMemoryUsed() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->memoryUsed;
+  }
+
+  size_t getHitCount() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->hitCount;
+  }
+
+  size_t getMissCount() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->missCount;
+  }
+
+  size_t getEvictionCount() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->evictionCount;
+  }
+};
+
+#endif
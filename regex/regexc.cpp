@@ -0,0 +1,61 @@
+#include "automaton_file.h"
+#include "regex.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Offline rule compiler: compiles every pattern of RULES, one per line, and
+ * writes their automata to OUTPUT in the format of automaton_file.h. Every
+ * line is a rule, numbered from 0, a blank one matches only the empty string.
+ */
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " RULES OUTPUT" << std::endl;
+    return 2;
+  }
+
+  std::ifstream rulesFile(argv[1]);
+  if (!rulesFile) {
+    std::cerr << argv[0] << ": can not read " << argv[1] << std::endl;
+    return 2;
+  }
+
+  std::vector<std::unique_ptr<Regex>> compiled;
+  std::string line;
+  size_t lineNumber = 0;
+  size_t withoutDfa = 0;
+  while (std::getline(rulesFile, line)) {
+    lineNumber++;
+    try {
+      compiled.push_back(Regex::compile(line));
+    } catch (const std::exception &error) {
+      std::cerr << argv[1] << ":" << lineNumber << ": invalid pattern " << line
+                << ": " << error.what() << std::endl;
+      return 2;
+    }
+    if (compiled.back()->getDfa() == nullptr) {
+      withoutDfa++;
+    }
+  }
+
+  std::vector<const Regex *> rules;
+  for (const std::unique_ptr<Regex> &regex : compiled) {
+    rules.push_back(regex.get());
+  }
+  if (!AutomatonFile::write(argv[2], rules)) {
+    std::cerr << argv[0] << ": can not write " << argv[2] << std::endl;
+    return 2;
+  }
+
+  std::cout << "compiled " << rules.size() << " rules into " << argv[2];
+  if (withoutDfa > 0) {
+    std::cout << ", " << withoutDfa << " too big for a DFA";
+  }
+  std::cout << std::endl;
+  return 0;
+}
@@ -0,0 +1,646 @@
+#ifndef STATIC_REGEX_H
+#define STATIC_REGEX_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * Regexes known at build time: staticMatch<"(c|o)*">(input) parses the
+ * pattern, builds its Thompson NFA and determinizes it while compiling, the
+ * binary only holds the final transition table and a loop over the input.
+ * There is no startup cost and nothing is allocated when matching.
+ *
+ * StaticParser is a second reader of the RegexAst grammar, since RegexAst is
+ * not usable in constant evaluation. It accepts a subset of it: the same
+ * concatenation by juxtaposition or '+', '|', '*', {n,m}, escapes and
+ * classes, with parentheses that only group, but repeat counts of at most
+ * maxStaticRepeatCount and at most maxStaticStates NFA states once every
+ * repeat is written out. Anything outside of that, like any invalid pattern,
+ * throws and so fails the build, it is never read differently. The tests
+ * check that both readers agree on the patterns they share.
+ *
+ * Everything below runs in constant evaluation only, the vectors are
+ * transient and never reach the binary.
+ */
+
+// a string literal usable as a template argument
+template <size_t N> struct FixedString {
+  char data[N] = {};
+
+  constexpr FixedString(const char (&pattern)[N]) {
+    for (size_t i = 0; i < N; i++) {
+      this->data[i] = pattern[i];
+    }
+  }
+
+  constexpr std::string_view view() const {
+    return std::string_view(this->data, N - 1);
+  }
+};
+
+// a set of bytes, bit b of word b / 64 for byte b
+using StaticByteSet = std::array<uint64_t, 4>;
+
+constexpr bool staticContains(const StaticByteSet &bytes, int byte) {
+  return (bytes[byte >> 6] >> (byte & 63)) & 1;
+}
+
+constexpr void staticInsert(StaticByteSet &bytes, int byte) {
+  bytes[byte >> 6] |= uint64_t(1) << (byte & 63);
+}
+
+// keeps repeats of repeats from writing out more than the compiler can
+// hold, RegexAst counts those instead
+inline constexpr int maxStaticStates = 100000;
+
+/*
+ * Thompson NFA: every state has at most one symbol edge, taken on any byte
+ * of its set, and at most two epsilon edges, -1 marks a missing edge.
+ */
+struct StaticNfa {
+  std::vector<StaticByteSet> symbolSets;
+  std::vector<int> symbolTargets;
+  std::vector<std::array<int, 2>> epsilons;
+  int start = 0;
+  int end = 0;
+
+  constexpr int createNewState() {
+    if (this->size() == maxStaticStates) {
+      throw std::invalid_argument("pattern too large for a static DFA");
+    }
+    this->symbolSets.push_back({});
+    this->symbolTargets.push_back(-1);
+    this->epsilons.push_back({-1, -1});
+    return this->symbolTargets.size() - 1;
+  }
+
+  constexpr void addEpsilonTransition(int from, int to) {
+    std::array<int, 2> &edges = this->epsilons[from];
+    if (edges[0] == -1) {
+      edges[0] = to;
+    } else if (edges[1] == -1) {
+      edges[1] = to;
+    } else {
+      throw std::logic_error("Thompson states have two epsilon edges at most");
+    }
+  }
+
+  constexpr int size() const { return this->symbolTargets.size(); }
+};
+
+// the byte a hex digit stands for, -1 if c is not one
+constexpr int staticHexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// keeps a typo in a static pattern from taking the compiler down with it
+inline constexpr int maxStaticRepeatCount = 1000;
+// the nesting RegexAst::maxDepth allows
+inline constexpr int maxStaticDepth = 1000;
+
+/*
+ * Recursive descent over the grammar of RegexAst, building a Thompson
+ * fragment (start and end state) for every sub-expression on the way back
+ * up. Errors throw, which fails the constant evaluation and so the build.
+ */
+struct StaticParser {
+  std::string_view pattern;
+  size_t position = 0;
+  // groups and repetitions around the current position, counted the way
+  // RegexAst counts them
+  int depth = 0;
+  StaticNfa nfa;
+
+  constexpr bool atEnd() const {
+    return this->position == this->pattern.size();
+  }
+
+  constexpr char peek() const { return this->pattern[this->position]; }
+
+  constexpr std::pair<int, int> bytes(const StaticByteSet &set) {
+    int start = this->nfa.createNewState();
+    int end = this->nfa.createNewState();
+    this->nfa.symbolSets[start] = set;
+    this->nfa.symbolTargets[start] = end;
+    return {start, end};
+  }
+
+  constexpr std::pair<int, int> literal(unsigned char c) {
+    StaticByteSet set = {};
+    staticInsert(set, c);
+    return this->bytes(set);
+  }
+
+  static constexpr bool isClassEscape(char c) {
+    return c == 'd' || c == 'D' || c == 'w' || c == 'W' || c == 's' ||
+           c == 'S';
+  }
+
+  // adds the bytes of \d \w \s or of their upper case complements
+  static constexpr void addClassEscape(char c, StaticByteSet &set) {
+    StaticByteSet named = {};
+    for (int byte = 0; byte < 128; byte++) {
+      bool digit = byte >= '0' && byte <= '9';
+      bool word = digit || (byte >= 'a' && byte <= 'z') ||
+                  (byte >= 'A' && byte <= 'Z') || byte == '_';
+      bool space = byte == ' ' || (byte >= '\t' && byte <= '\r');
+      if ((c == 'd' || c == 'D') ? digit
+          : (c == 'w' || c == 'W') ? word
+                                   : space) {
+        staticInsert(named, byte);
+      }
+    }
+    bool negated = c == 'D' || c == 'W' || c == 'S';
+    for (int byte = 0; byte < 256; byte++) {
+      if (staticContains(named, byte) != negated) {
+        staticInsert(set, byte);
+      }
+    }
+  }
+
+  constexpr unsigned char classByte() {
+    char c = this->pattern[this->position++];
+    if (c == '\\') {
+      if (!this->atEnd() && isClassEscape(this->peek())) {
+        throw std::invalid_argument("class escape used as a range bound");
+      }
+      return this->escape();
+    }
+    return c;
+  }
+
+  constexpr std::pair<int, int> byteClass() {
+    StaticByteSet set = {};
+    bool negated = !this->atEnd() && this->peek() == '^';
+    if (negated) {
+      this->position++;
+    }
+    bool first = true;
+    while (true) {
+      if (this->atEnd()) {
+        throw std::invalid_argument("missing ]");
+      }
+      if (this->peek() == ']' && !first) {
+        this->position++;
+        break;
+      }
+      first = false;
+      if (this->peek() == '\\' &&
+          this->position + 1 < this->pattern.size() &&
+          isClassEscape(this->pattern[this->position + 1])) {
+        addClassEscape(this->pattern[this->position + 1], set);
+        this->position += 2;
+        continue;
+      }
+      unsigned char low = this->classByte();
+      unsigned char high = low;
+      if (this->pattern.size() - this->position >= 2 && this->peek() == '-' &&
+          this->pattern[this->position + 1] != ']') {
+        this->position++;
+        high = this->classByte();
+        if (high < low) {
+          throw std::invalid_argument("range out of order");
+        }
+      }
+      for (int byte = low; byte <= high; byte++) {
+        staticInsert(set, byte);
+      }
+    }
+    if (negated) {
+      for (uint64_t &word : set) {
+        word = ~word;
+      }
+    }
+    return this->bytes(set);
+  }
+
+  constexpr unsigned char escape() {
+    if (this->atEnd()) {
+      throw std::invalid_argument("trailing backslash");
+    }
+    char c = this->pattern[this->position++];
+    switch (c) {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'v':
+      return '\v';
+    case '0':
+      return '\0';
+    case 'x': {
+      if (this->pattern.size() - this->position < 2 ||
+          staticHexValue(this->pattern[this->position]) == -1 ||
+          staticHexValue(this->pattern[this->position + 1]) == -1) {
+        throw std::invalid_argument("\\x needs two hex digits");
+      }
+      int value = staticHexValue(this->pattern[this->position]) * 16 +
+                  staticHexValue(this->pattern[this->position + 1]);
+      this->position += 2;
+      return value;
+    }
+    default:
+      if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z')) {
+        throw std::invalid_argument("unknown escape");
+      }
+      return c;
+    }
+  }
+
+  constexpr std::pair<int, int> atom() {
+    char c = this->pattern[this->position++];
+    if (c == '(') {
+      if (++this->depth > maxStaticDepth) {
+        throw std::invalid_argument("groups nested too deeply");
+      }
+      std::pair<int, int> group = this->alternation();
+      if (this->atEnd() || this->peek() != ')') {
+        throw std::invalid_argument("missing )");
+      }
+      this->position++;
+      this->depth--;
+      return group;
+    }
+    if (c == '[') {
+      return this->byteClass();
+    }
+    if (c == '.') {
+      StaticByteSet set = {~uint64_t(0), ~uint64_t(0), ~uint64_t(0),
+                           ~uint64_t(0)};
+      set[0] &= ~(uint64_t(1) << '\n');
+      return this->bytes(set);
+    }
+    if (c == '\\') {
+      if (!this->atEnd() && isClassEscape(this->peek())) {
+        StaticByteSet set = {};
+        addClassEscape(this->pattern[this->position++], set);
+        return this->bytes(set);
+      }
+      return this->literal(this->escape());
+    }
+    return this->literal(c);
+  }
+
+  constexpr std::pair<int, int> star(std::pair<int, int> x) {
+    int start = this->nfa.createNewState();
+    int end = this->nfa.createNewState();
+    this->nfa.addEpsilonTransition(start, x.first);
+    this->nfa.addEpsilonTransition(start, end);
+    this->nfa.addEpsilonTransition(x.second, x.first);
+    this->nfa.addEpsilonTransition(x.second, end);
+    return {start, end};
+  }
+
+  constexpr int count() {
+    if (this->atEnd() || this->peek() < '0' || this->peek() > '9') {
+      throw std::invalid_argument("repetition count expected");
+    }
+    int value = 0;
+    while (!this->atEnd() && this->peek() >= '0' && this->peek() <= '9') {
+      value = value * 10 + (this->peek() - '0');
+      if (value > maxStaticRepeatCount) {
+        throw std::invalid_argument("repetition count too large");
+      }
+      this->position++;
+    }
+    return value;
+  }
+
+  // a copy of fragment, whose states are all the states from first on and
+  // have no edges leaving them yet
+  constexpr std::pair<int, int> copy(std::pair<int, int> fragment,
+                                     int first, int last) {
+    int offset = this->nfa.size() - first;
+    for (int state = first; state < last; state++) {
+      int clone = this->nfa.createNewState();
+      this->nfa.symbolSets[clone] = this->nfa.symbolSets[state];
+      int target = this->nfa.symbolTargets[state];
+      this->nfa.symbolTargets[clone] = target == -1 ? -1 : target + offset;
+      for (int i = 0; i < 2; i++) {
+        int next = this->nfa.epsilons[state][i];
+        this->nfa.epsilons[clone][i] = next == -1 ? -1 : next + offset;
+      }
+    }
+    return {fragment.first + offset, fragment.second + offset};
+  }
+
+  // the bounds of x{n,m}, position is just past the '{', -1 for no maximum
+  constexpr std::pair<int, int> repeatBounds() {
+    int minCount = this->count();
+    int maxCount = minCount;
+    if (!this->atEnd() && this->peek() == ',') {
+      this->position++;
+      maxCount = !this->atEnd() && this->peek() == '}' ? -1 : this->count();
+    }
+    if (this->atEnd() || this->peek() != '}') {
+      throw std::invalid_argument("missing }");
+    }
+    if (maxCount != -1 && maxCount < minCount) {
+      throw std::invalid_argument("repetition bounds out of order");
+    }
+    this->position++;
+    return {minCount, maxCount};
+  }
+
+  /*
+   * x{n,m} written out, all copies are made before any of them is wired.
+   * There are no counters here, the repeats of a static pattern only cost
+   * build time.
+   */
+  constexpr std::pair<int, int> bounds(std::pair<int, int> x, int first,
+                                       int minCount, int maxCount) {
+    int last = this->nfa.size();
+    std::vector<std::pair<int, int>> copies = {x};
+    int copyCount = maxCount == -1 ? minCount + 1 : maxCount;
+    for (int i = 1; i < copyCount; i++) {
+      copies.push_back(this->copy(x, first, last));
+    }
+
+    int empty = this->nfa.createNewState();
+    std::pair<int, int> whole = {empty, empty};
+    for (int i = 0; i < minCount; i++) {
+      this->nfa.addEpsilonTransition(whole.second, copies[i].first);
+      whole.second = copies[i].second;
+    }
+    if (maxCount == -1) {
+      std::pair<int, int> loop = this->star(copies[minCount]);
+      this->nfa.addEpsilonTransition(whole.second, loop.first);
+      whole.second = loop.second;
+    } else if (maxCount > minCount) {
+      int end = this->nfa.createNewState();
+      for (int i = minCount; i < maxCount; i++) {
+        this->nfa.addEpsilonTransition(whole.second, copies[i].first);
+        this->nfa.addEpsilonTransition(whole.second, end);
+        whole.second = copies[i].second;
+      }
+      this->nfa.addEpsilonTransition(whole.second, end);
+      whole.second = end;
+    }
+    return whole;
+  }
+
+  constexpr std::pair<int, int> repetition() {
+    // the operand is always made of the states from first on
+    int first = this->nfa.size();
+    std::pair<int, int> x = this->atom();
+    // RegexAst folds x** into x* and x{1} into x, neither is a level
+    bool starred = false;
+    int wrapped = 0;
+    while (!this->atEnd() && (this->peek() == '*' || this->peek() == '{')) {
+      char c = this->pattern[this->position++];
+      std::pair<int, int> counts = {0, -1};
+      if (c == '{') {
+        counts = this->repeatBounds();
+      }
+      bool isStar = counts.first == 0 && counts.second == -1;
+      if (isStar ? starred : counts.first == 1 && counts.second == 1) {
+        continue;
+      }
+      starred = isStar;
+      wrapped++;
+      if (++this->depth > maxStaticDepth) {
+        throw std::invalid_argument("repetitions nested too deeply");
+      }
+      x = isStar ? this->star(x)
+                 : this->bounds(x, first, counts.first, counts.second);
+    }
+    this->depth -= wrapped;
+    return x;
+  }
+
+  constexpr std::pair<int, int> concatenation() {
+    // an empty concatenation is a single state, start and end at once
+    int empty = this->nfa.createNewState();
+    std::pair<int, int> whole = {empty, empty};
+    bool operand = false;
+    while (!this->atEnd()) {
+      char c = this->peek();
+      if (c == '|' || c == ')') {
+        break;
+      }
+      if (c == '+') {
+        this->position++;
+        if (!operand || this->atEnd() || this->peek() == '|' ||
+            this->peek() == ')' || this->peek() == '+') {
+          throw std::invalid_argument("+ needs two operands");
+        }
+        continue;
+      }
+      if (c == '*' || c == '{') {
+        throw std::invalid_argument("repetition without an operand");
+      }
+      std::pair<int, int> next = this->repetition();
+      this->nfa.addEpsilonTransition(whole.second, next.first);
+      whole.second = next.second;
+      operand = true;
+    }
+    return whole;
+  }
+
+  constexpr std::pair<int, int> alternation() {
+    std::pair<int, int> x = this->concatenation();
+    while (!this->atEnd() && this->peek() == '|') {
+      this->position++;
+      std::pair<int, int> y = this->concatenation();
+      int start = this->nfa.createNewState();
+      int end = this->nfa.createNewState();
+      this->nfa.addEpsilonTransition(start, x.first);
+      this->nfa.addEpsilonTransition(start, y.first);
+      this->nfa.addEpsilonTransition(x.second, end);
+      this->nfa.addEpsilonTransition(y.second, end);
+      x = {start, end};
+    }
+    return x;
+  }
+};
+
+constexpr StaticNfa staticNfa(std::string_view pattern) {
+  StaticParser parser;
+  parser.pattern = pattern;
+  std::pair<int, int> whole = parser.alternation();
+  if (!parser.atEnd()) {
+    throw std::invalid_argument("unbalanced )");
+  }
+  parser.nfa.start = whole.first;
+  parser.nfa.end = whole.second;
+  return parser.nfa;
+}
+
+/*
+ * Subset construction over byte classes: as in ByteClasses every byte set on
+ * an edge splits the classes into the bytes inside and outside of it. State
+ * 0 is the dead state and state 1 the start state, as in Dfa.
+ */
+struct StaticDfaBuilder {
+  std::array<unsigned char, 256> classOf = {};
+  std::array<unsigned char, 256> representatives = {};
+  int classCount = 1;
+  std::vector<int> transitions;
+  std::vector<char> accepting;
+
+  constexpr void split(const StaticByteSet &set) {
+    std::array<int, 512> renumbered = {};
+    renumbered.fill(-1);
+    int count = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      int key = this->classOf[byte] * 2 + staticContains(set, byte);
+      if (renumbered[key] == -1) {
+        renumbered[key] = count;
+        this->representatives[count] = byte;
+        count++;
+      }
+      this->classOf[byte] = renumbered[key];
+    }
+    this->classCount = count;
+  }
+
+  constexpr int stateCount() const { return this->accepting.size(); }
+};
+
+// the epsilon closure of states as a sorted list, marks is all zero between
+// calls
+constexpr std::vector<int> staticClosure(const StaticNfa &nfa,
+                                         std::vector<int> states,
+                                         std::vector<char> &marks) {
+  std::vector<int> closure;
+  for (int state : states) {
+    if (!marks[state]) {
+      marks[state] = 1;
+      closure.push_back(state);
+    }
+  }
+  for (size_t i = 0; i < closure.size(); i++) {
+    for (int next : nfa.epsilons[closure[i]]) {
+      if (next != -1 && !marks[next]) {
+        marks[next] = 1;
+        closure.push_back(next);
+      }
+    }
+  }
+  for (int state : closure) {
+    marks[state] = 0;
+  }
+  std::sort(closure.begin(), closure.end());
+  return closure;
+}
+
+constexpr StaticDfaBuilder determinizeStatic(std::string_view pattern) {
+  StaticNfa nfa = staticNfa(pattern);
+  StaticDfaBuilder dfa;
+
+  for (int state = 0; state < nfa.size(); state++) {
+    if (nfa.symbolTargets[state] != -1) {
+      dfa.split(nfa.symbolSets[state]);
+    }
+  }
+
+  std::vector<char> marks(nfa.size(), 0);
+  std::vector<std::vector<int>> subsets;
+  subsets.push_back({});
+  subsets.push_back(staticClosure(nfa, {nfa.start}, marks));
+
+  for (size_t current = 0; current < subsets.size(); current++) {
+    bool accepting = false;
+    std::vector<std::vector<int>> moves(dfa.classCount);
+    for (int state : subsets[current]) {
+      accepting = accepting || state == nfa.end;
+      if (nfa.symbolTargets[state] == -1) {
+        continue;
+      }
+      for (int byteClass = 0; byteClass < dfa.classCount; byteClass++) {
+        if (staticContains(nfa.symbolSets[state],
+                           dfa.representatives[byteClass])) {
+          moves[byteClass].push_back(nfa.symbolTargets[state]);
+        }
+      }
+    }
+    dfa.accepting.push_back(accepting);
+
+    for (const std::vector<int> &move : moves) {
+      if (move.empty()) {
+        dfa.transitions.push_back(0);
+        continue;
+      }
+      std::vector<int> next = staticClosure(nfa, move, marks);
+      size_t target = 1;
+      while (target < subsets.size() && subsets[target] != next) {
+        target++;
+      }
+      if (target == subsets.size()) {
+        subsets.push_back(next);
+      }
+      dfa.transitions.push_back(target);
+    }
+  }
+  return dfa;
+}
+
+// the finished automaton, sized exactly and stored in the binary
+template <size_t States, size_t Classes> struct StaticDfa {
+  std::array<unsigned char, 256> classOf = {};
+  std::array<int, States * Classes> transitions = {};
+  std::array<bool, States> accepting = {};
+
+  constexpr bool match(std::string_view input) const {
+    int state = 1;
+    for (char c : input) {
+      state = this->transitions[state * Classes +
+                                this->classOf[static_cast<unsigned char>(c)]];
+      if (state == 0) {
+        return false;
+      }
+    }
+    return this->accepting[state];
+  }
+
+  constexpr size_t getStateCount() const { return States; }
+};
+
+template <FixedString Pattern> consteval auto compileStatic() {
+  constexpr std::pair<size_t, size_t> shape = [] {
+    StaticDfaBuilder built = determinizeStatic(Pattern.view());
+    return std::pair<size_t, size_t>(built.stateCount(), built.classCount);
+  }();
+
+  StaticDfaBuilder built = determinizeStatic(Pattern.view());
+  StaticDfa<shape.first, shape.second> dfa;
+  dfa.classOf = built.classOf;
+  for (size_t i = 0; i < built.transitions.size(); i++) {
+    dfa.transitions[i] = built.transitions[i];
+  }
+  for (size_t i = 0; i < built.accepting.size(); i++) {
+    dfa.accepting[i] = built.accepting[i];
+  }
+  return dfa;
+}
+
+template <FixedString Pattern>
+inline constexpr auto staticDfa = compileStatic<Pattern>();
+
+// true when the whole input matches Pattern
+template <FixedString Pattern>
+constexpr bool staticMatch(std::string_view input) {
+  return staticDfa<Pattern>.match(input);
+}
+
+#endif